@@ -17,23 +17,2829 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <stdexcept>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 #if __cplusplus >= 202002L
 #include <span>
 #endif
 
+#if defined(__GNUC__) && !defined(STL_NO_SIMD)
+#define STL_SIMD
+#endif
+
+// kernels are compiled for several instruction sets and the best one for
+// the running CPU is picked when the library is loaded
+#if defined(STL_SIMD) && defined(__x86_64__) && defined(__ELF__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define STL_TARGET_CLONES __attribute__((target_clones("default", "sse4.2", "avx2", "avx512f")))
+#endif
+#endif
+
+#ifndef STL_TARGET_CLONES
+#define STL_TARGET_CLONES
+#endif
+
+#ifdef STL_SIMD
+#define STL_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define STL_ALWAYS_INLINE inline
+#endif
+
+#ifdef __GNUC__
+#define STL_NOINLINE __attribute__((noinline))
+#else
+#define STL_NOINLINE
+#endif
+
 namespace stl {
 
 namespace {
 
+#ifdef STL_SIMD
+constexpr size_t simd_lanes = 8;
+typedef double simd_double __attribute__((vector_size(simd_lanes * sizeof(double))));
+typedef float simd_float __attribute__((vector_size(simd_lanes * sizeof(double))));
+
+// Vector of accumulators of type A, as wide as simd_double.
+template<typename A>
+struct simd_vector;
+
+template<>
+struct simd_vector<double> {
+    typedef simd_double type;
+};
+
+template<>
+struct simd_vector<float> {
+    typedef simd_float type;
+};
+#endif
+
+// Selects the kernel overloads that accumulate in A.
+template<typename A>
+struct accumulate_in {};
+
+// Weighted sums of a loess window, with x measured from the fit point.
+template<typename A = double>
+struct window_sums {
+    A sw = 0.0;
+    A swx = 0.0;
+    A swxx = 0.0;
+    A swy = 0.0;
+    A swxy = 0.0;
+};
+
+// Tricube weight at distance r from the fit point of a window of
+// half-width h, for r between 0.001 h and 0.999 h. Tables and windows
+// weighted on the fly use it alike, so that they round the same way.
+template<typename A>
+STL_ALWAYS_INLINE A tricube(A r, A h) {
+    auto u = r / h;
+    auto t = (A) 1.0 - u * u * u;
+    return t * t * t;
+}
+
+// Sums of a window of m points starting at x0. Weights are read from a
+// table covering the whole window or, when table is null, computed as
+// tricube weights of half-width h. rw may be null.
+template<typename A, typename T>
+STL_ALWAYS_INLINE window_sums<A> tricube_sums_impl(const T* table, A h, const T* rw, const T* y, size_t m, A x0) {
+    auto h9 = (A) 0.999 * h;
+    auto h1 = (A) 0.001 * h;
+    auto weight = [&](size_t k, A x) {
+        T w;
+        if (table != nullptr) {
+            w = table[k];
+        } else {
+            auto r = std::abs(x);
+            w = r <= h1 ? 1.0 : (r <= h9 ? (T) tricube(r, h) : 0.0);
+        }
+        if (rw != nullptr) {
+            w *= rw[k];
+        }
+        return (A) w;
+    };
+
+    window_sums<A> s;
+    size_t k = 0;
+#ifdef STL_SIMD
+    typedef typename simd_vector<A>::type V;
+    constexpr size_t lanes = sizeof(V) / sizeof(A);
+    V sw = {};
+    V swx = {};
+    V swxx = {};
+    V swy = {};
+    V swxy = {};
+    V x;
+    for (size_t l = 0; l < lanes; l++) {
+        x[l] = x0 + (A) l;
+    }
+    for (; k + lanes <= m; k += lanes) {
+        V w;
+        V yk;
+        for (size_t l = 0; l < lanes; l++) {
+            w[l] = weight(k + l, x[l]);
+            yk[l] = y[k + l];
+        }
+        auto wy = w * yk;
+        sw += w;
+        swx += w * x;
+        swxx += w * x * x;
+        swy += wy;
+        swxy += wy * x;
+        x += (A) lanes;
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        s.sw += sw[l];
+        s.swx += swx[l];
+        s.swxx += swxx[l];
+        s.swy += swy[l];
+        s.swxy += swxy[l];
+    }
+#endif
+    for (; k < m; k++) {
+        auto x = x0 + (A) k;
+        auto w = weight(k, x);
+        auto wy = w * (A) y[k];
+        s.sw += w;
+        s.swx += w * x;
+        s.swxx += w * x * x;
+        s.swy += wy;
+        s.swxy += wy * x;
+    }
+    return s;
+}
+
+// Sum of y weighted by a kernel of m points, accumulated in the kernel's
+// type.
+template<typename A, typename T>
+STL_ALWAYS_INLINE A filter_sum_impl(const A* kernel, const T* y, size_t m) {
+    A s = 0.0;
+    size_t k = 0;
+#ifdef STL_SIMD
+    typedef typename simd_vector<A>::type V;
+    constexpr size_t lanes = sizeof(V) / sizeof(A);
+    V acc = {};
+    for (; k + lanes <= m; k += lanes) {
+        V kk;
+        V yk;
+        for (size_t l = 0; l < lanes; l++) {
+            kk[l] = kernel[k + l];
+            yk[l] = y[k + l];
+        }
+        acc += kk * yk;
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        s += acc[l];
+    }
+#endif
+    for (; k < m; k++) {
+        s += kernel[k] * (A) y[k];
+    }
+    return s;
+}
+
+// Moving average of length len. Long inputs are split into one chunk
+// per lane, each with its own running sum.
+template<typename A, typename T>
+STL_ALWAYS_INLINE void moving_average_impl(const T* x, size_t n, size_t len, T* ave) {
+    auto newn = n - len + 1;
+    A flen = (T) len;
+    A v = 0.0;
+    size_t j = 0;
+
+#ifdef STL_SIMD
+    typedef typename simd_vector<A>::type V;
+    constexpr size_t lanes = sizeof(V) / sizeof(A);
+    if (newn >= 4 * lanes * len) {
+        auto c = newn / lanes;
+        V lv;
+        for (size_t l = 0; l < lanes; l++) {
+            lv[l] = 0.0;
+            for (size_t i = 0; i < len; i++) {
+                lv[l] += x[l * c + i];
+            }
+        }
+        for (size_t t = 0; t < c; t++) {
+            auto a = lv / flen;
+            for (size_t l = 0; l < lanes; l++) {
+                ave[l * c + t] = (T) a[l];
+            }
+            // the window after the last one can end past the input
+            if (t + 1 == c) {
+                break;
+            }
+            V d;
+            for (size_t l = 0; l < lanes; l++) {
+                d[l] = (A) x[l * c + t + len] - (A) x[l * c + t];
+            }
+            lv += d;
+        }
+        // the last lane finishes the remainder
+        v = lv[lanes - 1];
+        j = lanes * c;
+    }
+#endif
+
+    if (j == 0) {
+        // get the first average
+        for (size_t i = 0; i < len; i++) {
+            v += x[i];
+        }
+        ave[0] = (T) (v / flen);
+        j = 1;
+    }
+    for (; j < newn; j++) {
+        // window down the array
+        v = v - x[j - 1] + x[j + len - 1];
+        ave[j] = (T) (v / flen);
+    }
+}
+
+// Bisquare robustness weights from absolute residuals.
+template<typename A, typename T>
+STL_ALWAYS_INLINE void bisquare_weights_impl(const T* resid, size_t n, A cmad, T* rw) {
+    auto c9 = (A) 0.999 * cmad;
+    auto c1 = (A) 0.001 * cmad;
+    for (size_t i = 0; i < n; i++) {
+        A r = resid[i];
+        auto u = r / cmad;
+        auto t = (A) 1.0 - u * u;
+        rw[i] = r <= c1 ? 1.0 : (r <= c9 ? (T) (t * t) : 0.0);
+    }
+}
+
+STL_TARGET_CLONES inline window_sums<double> tricube_sums(const float* table, double h, const float* rw, const float* y, size_t m, double x0, accumulate_in<double> = {}) {
+    return tricube_sums_impl(table, h, rw, y, m, x0);
+}
+
+STL_TARGET_CLONES inline window_sums<double> tricube_sums(const double* table, double h, const double* rw, const double* y, size_t m, double x0, accumulate_in<double> = {}) {
+    return tricube_sums_impl(table, h, rw, y, m, x0);
+}
+
+STL_TARGET_CLONES inline window_sums<float> tricube_sums(const float* table, float h, const float* rw, const float* y, size_t m, float x0, accumulate_in<float>) {
+    return tricube_sums_impl(table, h, rw, y, m, x0);
+}
+
+STL_TARGET_CLONES inline double filter_sum(const double* kernel, const float* y, size_t m) {
+    return filter_sum_impl(kernel, y, m);
+}
+
+STL_TARGET_CLONES inline double filter_sum(const double* kernel, const double* y, size_t m) {
+    return filter_sum_impl(kernel, y, m);
+}
+
+STL_TARGET_CLONES inline float filter_sum(const float* kernel, const float* y, size_t m) {
+    return filter_sum_impl(kernel, y, m);
+}
+
+STL_TARGET_CLONES inline void moving_average(const float* x, size_t n, size_t len, float* ave, accumulate_in<double> = {}) {
+    moving_average_impl<double>(x, n, len, ave);
+}
+
+STL_TARGET_CLONES inline void moving_average(const double* x, size_t n, size_t len, double* ave, accumulate_in<double> = {}) {
+    moving_average_impl<double>(x, n, len, ave);
+}
+
+STL_TARGET_CLONES inline void moving_average(const float* x, size_t n, size_t len, float* ave, accumulate_in<float>) {
+    moving_average_impl<float>(x, n, len, ave);
+}
+
+STL_TARGET_CLONES inline void bisquare_weights(const float* resid, size_t n, double cmad, float* rw) {
+    bisquare_weights_impl(resid, n, cmad, rw);
+}
+
+STL_TARGET_CLONES inline void bisquare_weights(const double* resid, size_t n, double cmad, double* rw) {
+    bisquare_weights_impl(resid, n, cmad, rw);
+}
+
+STL_TARGET_CLONES inline void bisquare_weights(const float* resid, size_t n, float cmad, float* rw) {
+    bisquare_weights_impl(resid, n, cmad, rw);
+}
+
+// Count, mean and sum of squared deviations of values, updated one value
+// at a time (Welford) or merged with those of other values (Chan et al.).
+struct moments {
+    double count = 0.0;
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    STL_ALWAYS_INLINE void add(double x) {
+        count += 1.0;
+        auto d = x - mean;
+        mean += d / count;
+        m2 += d * (x - mean);
+    }
+
+    void merge(const moments& o) {
+        if (o.count == 0.0) {
+            return;
+        }
+        auto total = count + o.count;
+        auto d = o.mean - mean;
+        mean += d * (o.count / total);
+        m2 += o.m2 + d * d * (count * o.count / total);
+        count = total;
+    }
+
+    inline double var() const {
+        return m2 / (count - 1.0);
+    }
+};
+
+// Strength of a component from the moments of the remainder and of the
+// component plus the remainder.
+inline double strength(const moments& r, const moments& cr) {
+    return std::max(0.0, 1.0 - r.var() / cr.var());
+}
+
+#ifdef STL_SIMD
+// Moments of each lane of a vector, which all see the same number of
+// values.
+struct simd_moments {
+    simd_double mean = {};
+    simd_double m2 = {};
+
+    STL_ALWAYS_INLINE void add(const simd_double& x, double inv) {
+        auto d = x - mean;
+        mean += d * inv;
+        m2 += d * (x - mean);
+    }
+
+    void merge_into(moments& m, double count) const {
+        for (size_t l = 0; l < simd_lanes; l++) {
+            m.merge(moments{count, mean[l], m2[l]});
+        }
+    }
+};
+#endif
+
+// Moments of the remainder, when r is not null, and of the component plus
+// the remainder, leaving out missing values, whose remainder is NaN.
+// Lanes skip blocks with missing values, which are added one at a time.
+template<typename T>
+STL_ALWAYS_INLINE void component_moments_impl(const T* component, const T* remainder, size_t n, moments* r, moments& cr) {
+    size_t i = 0;
+#ifdef STL_SIMD
+    simd_moments vr;
+    simd_moments vcr;
+    double count = 0.0;
+    for (; i + simd_lanes <= n; i += simd_lanes) {
+        simd_double rv;
+        simd_double crv;
+        bool missing = false;
+        for (size_t l = 0; l < simd_lanes; l++) {
+            rv[l] = remainder[i + l];
+            crv[l] = (double) component[i + l] + rv[l];
+            missing |= std::isnan(rv[l]);
+        }
+        if (missing) {
+            for (size_t l = 0; l < simd_lanes; l++) {
+                if (!std::isnan(rv[l])) {
+                    if (r != nullptr) {
+                        r->add(rv[l]);
+                    }
+                    cr.add(crv[l]);
+                }
+            }
+            continue;
+        }
+        count += 1.0;
+        auto inv = 1.0 / count;
+        if (r != nullptr) {
+            vr.add(rv, inv);
+        }
+        vcr.add(crv, inv);
+    }
+    if (r != nullptr) {
+        vr.merge_into(*r, count);
+    }
+    vcr.merge_into(cr, count);
+#endif
+    for (; i < n; i++) {
+        double rv = remainder[i];
+        if (!std::isnan(rv)) {
+            if (r != nullptr) {
+                r->add(rv);
+            }
+            cr.add((double) component[i] + rv);
+        }
+    }
+}
+
+// Writes the remainder of a series and accumulates the moments of the
+// seasonal and trend strengths, in the same pass.
+template<typename T>
+STL_ALWAYS_INLINE void remainder_moments_impl(const T* y, const T* seasonal, const T* trend, size_t n, T* remainder, moments& r, moments& sr, moments& tr) {
+    size_t i = 0;
+#ifdef STL_SIMD
+    simd_moments vr;
+    simd_moments vsr;
+    simd_moments vtr;
+    double count = 0.0;
+    for (; i + simd_lanes <= n; i += simd_lanes) {
+        simd_double rv;
+        simd_double srv;
+        simd_double trv;
+        bool missing = false;
+        for (size_t l = 0; l < simd_lanes; l++) {
+            remainder[i + l] = y[i + l] - seasonal[i + l] - trend[i + l];
+            rv[l] = remainder[i + l];
+            srv[l] = (double) seasonal[i + l] + rv[l];
+            trv[l] = (double) trend[i + l] + rv[l];
+            missing |= std::isnan(rv[l]);
+        }
+        if (missing) {
+            for (size_t l = 0; l < simd_lanes; l++) {
+                if (!std::isnan(rv[l])) {
+                    r.add(rv[l]);
+                    sr.add(srv[l]);
+                    tr.add(trv[l]);
+                }
+            }
+            continue;
+        }
+        count += 1.0;
+        auto inv = 1.0 / count;
+        vr.add(rv, inv);
+        vsr.add(srv, inv);
+        vtr.add(trv, inv);
+    }
+    vr.merge_into(r, count);
+    vsr.merge_into(sr, count);
+    vtr.merge_into(tr, count);
+#endif
+    for (; i < n; i++) {
+        remainder[i] = y[i] - seasonal[i] - trend[i];
+        double rv = remainder[i];
+        if (!std::isnan(rv)) {
+            r.add(rv);
+            sr.add((double) seasonal[i] + rv);
+            tr.add((double) trend[i] + rv);
+        }
+    }
+}
+
+STL_TARGET_CLONES inline void component_moments(const float* component, const float* remainder, size_t n, moments* r, moments& cr) {
+    component_moments_impl(component, remainder, n, r, cr);
+}
+
+STL_TARGET_CLONES inline void component_moments(const double* component, const double* remainder, size_t n, moments* r, moments& cr) {
+    component_moments_impl(component, remainder, n, r, cr);
+}
+
+STL_TARGET_CLONES inline void remainder_moments(const float* y, const float* seasonal, const float* trend, size_t n, float* remainder, moments& r, moments& sr, moments& tr) {
+    remainder_moments_impl(y, seasonal, trend, n, remainder, r, sr, tr);
+}
+
+STL_TARGET_CLONES inline void remainder_moments(const double* y, const double* seasonal, const double* trend, size_t n, double* remainder, moments& r, moments& sr, moments& tr) {
+    remainder_moments_impl(y, seasonal, trend, n, remainder, r, sr, tr);
+}
+
+// Unsigned integers as wide as the doubles of V, for the log and exp
+// kernels, which run on single doubles or on vectors of them. The kernels
+// work in place so vectors are never passed or returned by value.
+template<typename V>
+struct bits_of {
+    typedef uint64_t type;
+};
+
+template<typename V, typename U>
+STL_ALWAYS_INLINE void copy_bits(const V& from, U& to) {
+    static_assert(sizeof(V) == sizeof(U));
+    std::memcpy(&to, &from, sizeof(to));
+}
+
+// Sets v to a where mask is set.
+STL_ALWAYS_INLINE void blend(double& v, bool mask, double a) {
+    if (mask) {
+        v = a;
+    }
+}
+
+#ifdef STL_SIMD
+typedef uint64_t simd_uint64 __attribute__((vector_size(simd_lanes * sizeof(double))));
+
+template<>
+struct bits_of<simd_double> {
+    typedef simd_uint64 type;
+};
+
+template<typename M>
+STL_ALWAYS_INLINE void blend(simd_double& v, const M& mask, const simd_double& a) {
+    v = (simd_double) ((mask & (M) a) | (~mask & (M) v));
+}
+
+// Whether any lane of a mask is set.
+template<typename M>
+STL_ALWAYS_INLINE bool has_lanes(const M& mask) {
+    typename std::remove_reference<decltype(mask[0])>::type any = 0;
+    for (size_t l = 0; l < simd_lanes; l++) {
+        any |= mask[l];
+    }
+    return any != 0;
+}
+#endif
+
+// Natural log in place, to within float precision. Splits x into 2^e * m
+// with m in [sqrt(1/2), sqrt(2)) and sums the series of
+// 2 atanh((m - 1) / (m + 1)).
+template<typename V>
+STL_ALWAYS_INLINE void log_kernel(V& x) {
+    typename bits_of<V>::type bits;
+    copy_bits(x, bits);
+    // the exponent bits, read as a double by placing them in the mantissa
+    // of 2^52
+    V e;
+    V m;
+    copy_bits(((bits >> 52) & 0x7ff) | 0x4330000000000000ull, e);
+    copy_bits((bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull, m);
+    e = e - 4503599627370496.0 - 1023.0;
+    auto big = m > 1.4142135623730951;
+    blend(m, big, 0.5 * m);
+    blend(e, big, e + 1.0);
+
+    V t = (m - 1.0) / (m + 1.0);
+    V t2 = t * t;
+    V p = 1.0 + t2 * (1.0 / 3.0 + t2 * (1.0 / 5.0 + t2 * (1.0 / 7.0 + t2 * (1.0 / 9.0))));
+    V v = e * 0.6931471805599453 + 2.0 * t * p;
+
+    // zero, infinite, negative and NaN values
+    blend(v, x == std::numeric_limits<double>::infinity(), x);
+    blend(v, x == 0.0, V{} - std::numeric_limits<double>::infinity());
+    blend(v, !(x >= 0.0), V{} + std::numeric_limits<double>::quiet_NaN());
+    x = v;
+}
+
+// Exponential in place, to within float precision. Splits x into
+// k ln 2 + r with |r| <= ln 2 / 2, sums the Taylor series of e^r, and
+// scales by 2^k through the exponent bits.
+template<typename V>
+STL_ALWAYS_INLINE void exp_kernel(V& x) {
+    // results out of this range are 0 or infinite as floats
+    V c = x;
+    blend(c, x < -708.0, V{} - 708.0);
+    blend(c, x > 709.0, V{} + 709.0);
+    // adding 1.5 * 2^52 rounds to an integer, kept in the low bits
+    V shifted = c * 1.4426950408889634 + 6755399441055744.0;
+    V k = shifted - 6755399441055744.0;
+    V r = c - k * 0.6931471805599453;
+    V p = 1.0 + r * (1.0 + r * (1.0 / 2.0 + r * (1.0 / 6.0 + r * (1.0 / 24.0 + r * (1.0 / 120.0 + r * (1.0 / 720.0 + r * (1.0 / 5040.0 + r * (1.0 / 40320.0))))))));
+    typename bits_of<V>::type bits;
+    copy_bits(shifted, bits);
+    V scale;
+    copy_bits((bits + 1023) << 52, scale);
+    V v = p * scale;
+
+    blend(v, x > 709.0, V{} + std::numeric_limits<double>::infinity());
+    blend(v, x < -708.0, V{});
+    blend(v, x != x, x);
+    x = v;
+}
+
+// Box-Cox transformation of x in place.
+template<typename V>
+STL_ALWAYS_INLINE void box_cox_kernel(V& x, double lambda) {
+    log_kernel(x);
+    if (lambda != 0.0) {
+        x = lambda * x;
+        exp_kernel(x);
+        x = (x - 1.0) / lambda;
+    }
+}
+
+// Inverse Box-Cox transformation of x in place.
+template<typename V>
+STL_ALWAYS_INLINE void inv_box_cox_kernel(V& x, double lambda) {
+    if (lambda != 0.0) {
+        x = lambda * x + 1.0;
+        log_kernel(x);
+        x = x / lambda;
+    }
+    exp_kernel(x);
+}
+
+// Box-Cox transformation of a value through the standard library, which
+// also covers the values the kernels leave out, such as negative values
+// with lambda 1.
+inline double box_cox_value(double y, double lambda) {
+    return lambda == 0.0 ? std::log(y) : (std::pow(y, lambda) - 1.0) / lambda;
+}
+
+// Inverse Box-Cox transformation of a value through the standard library.
+inline double inv_box_cox_value(double z, double lambda) {
+    return lambda == 0.0 ? std::exp(z) : std::pow(lambda * z + 1.0, 1.0 / lambda);
+}
+
+// Box-Cox transformation of y into out, which may be y. The kernels take
+// the log of y, so values that are not positive go through the standard
+// library unless lambda is 0.
+template<typename T>
+STL_ALWAYS_INLINE void box_cox_impl(const T* y, size_t n, double lambda, T* out) {
+    size_t i = 0;
+#ifdef STL_SIMD
+    for (; i + simd_lanes <= n; i += simd_lanes) {
+        simd_double x;
+        for (size_t l = 0; l < simd_lanes; l++) {
+            x[l] = y[i + l];
+        }
+        simd_double v = x;
+        box_cox_kernel(x, lambda);
+        for (size_t l = 0; l < simd_lanes; l++) {
+            out[i + l] = (T) x[l];
+        }
+        if (lambda != 0.0 && has_lanes(!(v > 0.0))) {
+            for (size_t l = 0; l < simd_lanes; l++) {
+                if (!(v[l] > 0.0)) {
+                    out[i + l] = (T) box_cox_value(v[l], lambda);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        double x = y[i];
+        box_cox_kernel(x, lambda);
+        out[i] = (T) (lambda == 0.0 || y[i] > 0 ? x : box_cox_value(y[i], lambda));
+    }
+}
+
+// Inverse Box-Cox transformation of z in place. Values whose lambda z + 1
+// is not positive go through the standard library.
+template<typename T>
+STL_ALWAYS_INLINE void inv_box_cox_impl(T* z, size_t n, double lambda) {
+    size_t i = 0;
+#ifdef STL_SIMD
+    for (; i + simd_lanes <= n; i += simd_lanes) {
+        simd_double x;
+        for (size_t l = 0; l < simd_lanes; l++) {
+            x[l] = z[i + l];
+        }
+        simd_double v = x;
+        inv_box_cox_kernel(x, lambda);
+        for (size_t l = 0; l < simd_lanes; l++) {
+            z[i + l] = (T) x[l];
+        }
+        if (lambda != 0.0 && has_lanes(!(lambda * v + 1.0 > 0.0))) {
+            for (size_t l = 0; l < simd_lanes; l++) {
+                if (!(lambda * v[l] + 1.0 > 0.0)) {
+                    z[i + l] = (T) inv_box_cox_value(v[l], lambda);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        double x = z[i];
+        inv_box_cox_kernel(x, lambda);
+        z[i] = (T) (lambda == 0.0 || lambda * z[i] + 1.0 > 0.0 ? x : inv_box_cox_value(z[i], lambda));
+    }
+}
+
+#ifdef STL_SIMD
+STL_TARGET_CLONES inline void box_cox_values(const float* y, size_t n, double lambda, float* out) {
+    box_cox_impl(y, n, lambda, out);
+}
+
+STL_TARGET_CLONES inline void inv_box_cox_values(float* z, size_t n, double lambda) {
+    inv_box_cox_impl(z, n, lambda);
+}
+#endif
+
+// Double series keep double precision through the standard library, as do
+// float series without SIMD, where the kernels are slower than it.
+template<typename T>
+void box_cox_values(const T* y, size_t n, double lambda, T* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (T) box_cox_value(y[i], lambda);
+    }
+}
+
+template<typename T>
+void inv_box_cox_values(T* z, size_t n, double lambda) {
+    for (size_t i = 0; i < n; i++) {
+        z[i] = (T) inv_box_cox_value(z[i], lambda);
+    }
+}
+
+// Box-Cox transformation of a series to fit into out, which may be the
+// series. Values the transformation leaves undefined or infinite are
+// rejected rather than fitted as missing.
+template<typename T>
+void box_cox_series(const T* y, size_t n, double lambda, T* out) {
+    for (size_t i = 0; i < n; i++) {
+        if (lambda != 1.0 && (y[i] < 0 || (y[i] == 0 && lambda == 0.0))) {
+            throw std::invalid_argument("series has values outside the domain of the Box-Cox transformation");
+        }
+    }
+    box_cox_values(y, n, lambda, out);
+}
+
+// Series decomposed together by fit_batch. Batched arrays hold the lanes
+// of each point next to each other.
+constexpr size_t batch_lanes = 8;
+
+#ifdef STL_SIMD
+typedef simd_double batch_double;
+#else
+// Lane values of a batch.
+struct batch_double {
+    double v[batch_lanes] = {};
+
+    double& operator[](size_t l) {
+        return v[l];
+    }
+
+    batch_double& operator+=(const batch_double& o) {
+        for (size_t l = 0; l < batch_lanes; l++) {
+            v[l] += o.v[l];
+        }
+        return *this;
+    }
+
+    batch_double operator+(const batch_double& o) const {
+        batch_double r;
+        for (size_t l = 0; l < batch_lanes; l++) {
+            r.v[l] = v[l] + o.v[l];
+        }
+        return r;
+    }
+
+    batch_double operator-(const batch_double& o) const {
+        batch_double r;
+        for (size_t l = 0; l < batch_lanes; l++) {
+            r.v[l] = v[l] - o.v[l];
+        }
+        return r;
+    }
+
+    batch_double operator*(const batch_double& o) const {
+        batch_double r;
+        for (size_t l = 0; l < batch_lanes; l++) {
+            r.v[l] = v[l] * o.v[l];
+        }
+        return r;
+    }
+
+    batch_double operator*(double o) const {
+        batch_double r;
+        for (size_t l = 0; l < batch_lanes; l++) {
+            r.v[l] = v[l] * o;
+        }
+        return r;
+    }
+};
+#endif
+
+template<typename T>
+STL_ALWAYS_INLINE void batch_load(const T* x, batch_double& r) {
+    for (size_t l = 0; l < batch_lanes; l++) {
+        r[l] = x[l];
+    }
+}
+
+// Sums of a window of m points starting at x0 for every lane. The weights
+// are shared by the lanes and read from table, or computed like
+// tricube_sums when table is null. rw may be null.
+template<typename T>
+STL_ALWAYS_INLINE void batch_tricube_sums_impl(const T* table, double h, const T* rw, const T* y, size_t m, double x0, window_sums<>* s) {
+    auto h9 = 0.999 * h;
+    auto h1 = 0.001 * h;
+    batch_double sw = {};
+    batch_double swx = {};
+    batch_double swxx = {};
+    batch_double swy = {};
+    batch_double swxy = {};
+    for (size_t k = 0; k < m; k++) {
+        auto x = x0 + (double) k;
+        T w;
+        if (table != nullptr) {
+            w = table[k];
+        } else {
+            auto r = std::abs(x);
+            w = r <= h1 ? 1.0 : (r <= h9 ? (T) tricube(r, h) : 0.0);
+        }
+        batch_double wl;
+        if (rw != nullptr) {
+            for (size_t l = 0; l < batch_lanes; l++) {
+                wl[l] = (T) (w * rw[k * batch_lanes + l]);
+            }
+        } else {
+            for (size_t l = 0; l < batch_lanes; l++) {
+                wl[l] = w;
+            }
+        }
+        batch_double yl;
+        batch_load(y + k * batch_lanes, yl);
+        auto wy = wl * yl;
+        sw += wl;
+        swx += wl * x;
+        swxx += wl * x * x;
+        swy += wy;
+        swxy += wy * x;
+    }
+    for (size_t l = 0; l < batch_lanes; l++) {
+        s[l] = window_sums<> {sw[l], swx[l], swxx[l], swy[l], swxy[l]};
+    }
+}
+
+// Sum of every lane weighted by a kernel of m points.
+template<typename T>
+STL_ALWAYS_INLINE void batch_filter_sum_impl(const double* kernel, const T* y, size_t m, T* out) {
+    batch_double acc = {};
+    for (size_t k = 0; k < m; k++) {
+        batch_double yl;
+        batch_load(y + k * batch_lanes, yl);
+        acc += yl * kernel[k];
+    }
+    for (size_t l = 0; l < batch_lanes; l++) {
+        out[l] = (T) acc[l];
+    }
+}
+
+// Moving average of length len for every lane.
+template<typename T>
+STL_ALWAYS_INLINE void batch_moving_average_impl(const T* x, size_t n, size_t len, T* ave) {
+    auto newn = n - len + 1;
+    double flen = (T) len;
+    batch_double v = {};
+    batch_double in;
+    batch_double out;
+
+    // get the first average
+    for (size_t i = 0; i < len; i++) {
+        batch_load(x + i * batch_lanes, in);
+        v += in;
+    }
+    for (size_t j = 0; j < newn; j++) {
+        if (j > 0) {
+            // window down the array
+            batch_load(x + (j - 1) * batch_lanes, out);
+            batch_load(x + (j + len - 1) * batch_lanes, in);
+            v = v - out + in;
+        }
+        for (size_t l = 0; l < batch_lanes; l++) {
+            ave[j * batch_lanes + l] = (T) (v[l] / flen);
+        }
+    }
+}
+
+STL_TARGET_CLONES inline void batch_tricube_sums(const float* table, double h, const float* rw, const float* y, size_t m, double x0, window_sums<>* s) {
+    batch_tricube_sums_impl(table, h, rw, y, m, x0, s);
+}
+
+STL_TARGET_CLONES inline void batch_tricube_sums(const double* table, double h, const double* rw, const double* y, size_t m, double x0, window_sums<>* s) {
+    batch_tricube_sums_impl(table, h, rw, y, m, x0, s);
+}
+
+STL_TARGET_CLONES inline void batch_filter_sum(const double* kernel, const float* y, size_t m, float* out) {
+    batch_filter_sum_impl(kernel, y, m, out);
+}
+
+STL_TARGET_CLONES inline void batch_filter_sum(const double* kernel, const double* y, size_t m, double* out) {
+    batch_filter_sum_impl(kernel, y, m, out);
+}
+
+STL_TARGET_CLONES inline void batch_moving_average(const float* x, size_t n, size_t len, float* ave) {
+    batch_moving_average_impl(x, n, len, ave);
+}
+
+STL_TARGET_CLONES inline void batch_moving_average(const double* x, size_t n, size_t len, double* ave) {
+    batch_moving_average_impl(x, n, len, ave);
+}
+
+// Runs f(0), ..., f(count - 1) on their own threads, the first one on the
+// calling thread.
+template<typename F>
+void parallel_invoke(size_t count, F f) {
+    std::vector<std::thread> threads;
+    threads.reserve(count - 1);
+    for (size_t t = 1; t < count; t++) {
+        threads.emplace_back(f, t);
+    }
+    f(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// series at least this long may select the median on several threads
+constexpr size_t parallel_select_min_size = 1 << 20;
+
+// Finds the order statistics k1 and k2 of n non-negative values by radix
+// selection on their bit patterns, which order the same way as the
+// values. Each pass counts one byte of the candidates on every thread.
+template<typename T>
+void parallel_select(const T* v, size_t n, size_t k1, size_t k2, size_t threads, T* out1, T* out2) {
+    using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    constexpr size_t buckets = 256;
+
+    U prefix[2] = {0, 0};
+    size_t rank[2] = {k1, k2};
+    U mask = 0;
+    std::vector<std::array<size_t, 2 * buckets>> counts(threads);
+    auto chunk = (n + threads - 1) / threads;
+
+    for (int shift = 8 * sizeof(U) - 8; shift >= 0; shift -= 8) {
+        parallel_invoke(threads, [&](size_t t) {
+            auto& c = counts[t];
+            c.fill(0);
+            auto end = std::min(n, (t + 1) * chunk);
+            for (auto i = t * chunk; i < end; i++) {
+                U b;
+                std::memcpy(&b, &v[i], sizeof(U));
+                auto d = (size_t) ((b >> shift) & 0xff);
+                if ((b & mask) == prefix[0]) {
+                    c[d]++;
+                }
+                if ((b & mask) == prefix[1]) {
+                    c[buckets + d]++;
+                }
+            }
+        });
+
+        for (size_t s = 0; s < 2; s++) {
+            size_t d = 0;
+            for (; d < buckets; d++) {
+                size_t total = 0;
+                for (auto& c : counts) {
+                    total += c[s * buckets + d];
+                }
+                if (rank[s] < total) {
+                    break;
+                }
+                rank[s] -= total;
+            }
+            prefix[s] |= ((U) d) << shift;
+        }
+        mask |= ((U) 0xff) << shift;
+    }
+
+    std::memcpy(out1, &prefix[0], sizeof(U));
+    std::memcpy(out2, &prefix[1], sizeof(U));
+}
+
+typedef std::complex<double> complex;
+
+constexpr double pi = 3.14159265358979323846;
+
+// Transform of a filter kernel for fft_filter.
+struct fft_kernel {
+    size_t size = 0;
+    std::vector<complex> roots;
+    std::vector<complex> spectrum;
+};
+
+// Tricube weights of a centered window of half-width h, computed exactly
+// as est would compute them. Without robustness weights the fit at the
+// center of the window is the same linear filter everywhere, given by
+// the normalized weights in kernel.
+template<typename T>
+struct tricube_table {
+    T h;
+    size_t len;
+    std::vector<T> weights;
+    std::vector<double> kernel;
+    std::vector<float> float_kernel;
+    fft_kernel fft;
+};
+
+// Tables shared by every fit point, inner loop and robustness iteration
+// of a decomposition. There is one per smoother, so a handful at most.
+template<typename T>
+class tricube_cache {
+public:
+    tricube_table<T>& get(T h, size_t len) {
+        for (auto& table : tables_) {
+            if (table.h == h && table.len == len) {
+                return table;
+            }
+        }
+
+        auto h9 = 0.999 * h;
+        auto h1 = 0.001 * h;
+        auto half = (size_t) h;
+        std::vector<T> weights(2 * half + 1);
+        for (size_t k = 0; k <= half; k++) {
+            auto r = (T) k;
+            T w = 0.0;
+            if (r <= h9) {
+                if (r <= h1) {
+                    w = 1.0;
+                } else {
+                    w = (T) tricube((double) k, (double) h);
+                }
+            }
+            weights[half - k] = w;
+            weights[half + k] = w;
+        }
+        auto sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+        std::vector<double> kernel;
+        kernel.reserve(weights.size());
+        for (auto w : weights) {
+            kernel.push_back(w / sum);
+        }
+        std::vector<float> float_kernel(kernel.begin(), kernel.end());
+        tables_.push_back(tricube_table<T> { h, len, std::move(weights), std::move(kernel), std::move(float_kernel), fft_kernel() });
+        return tables_.back();
+    }
+
+private:
+    std::vector<tricube_table<T>> tables_;
+};
+
+// kernels at least this long are applied with fft_filter
+constexpr size_t fft_filter_min_len = 256;
+
+// The FFT computes every point, while the direct filter only computes the
+// points a smoother fits, every njump-th one, at len multiply-adds each.
+// The FFT only pays off once the window is a few hundred times the jump:
+// for a 2001-point window on 200k points, it takes the smoother from 143 ms
+// to 27 ms with jump 1, breaks even near jump 16, and is slower with the
+// default jumps of a tenth of the window. Default fits keep the direct
+// filter, and the FFT serves smoothers given small jumps.
+inline bool use_fft_filter(size_t len, size_t njump) {
+    return len >= fft_filter_min_len && len >= 128 * njump;
+}
+
+inline complex cmul(complex a, complex b) {
+    return complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+// In-place radix-2 FFT, with roots[k] = exp(-2 pi i k / n) for k < n / 2.
+// The inverse is not scaled.
+inline void fft(complex* a, size_t n, const complex* roots, bool inverse) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        auto bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(a[i], a[j]);
+        }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        auto half = len / 2;
+        auto step = n / len;
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t k = 0; k < half; k++) {
+                auto w = inverse ? std::conj(roots[k * step]) : roots[k * step];
+                auto u = a[i + k];
+                auto v = cmul(a[i + k + half], w);
+                a[i + k] = u + v;
+                a[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+inline void prepare_fft_kernel(const std::vector<double>& kernel, fft_kernel& fk) {
+    if (fk.size != 0) {
+        return;
+    }
+    size_t size = 1;
+    while (size < 4 * kernel.size()) {
+        size <<= 1;
+    }
+    fk.roots.resize(size / 2);
+    for (size_t k = 0; k < size / 2; k++) {
+        fk.roots[k] = std::polar(1.0, -2.0 * pi * (double) k / (double) size);
+    }
+    fk.spectrum.assign(size, 0.0);
+    for (size_t k = 0; k < kernel.size(); k++) {
+        fk.spectrum[k] = kernel[k] / (double) size;
+    }
+    fft(fk.spectrum.data(), size, fk.roots.data(), false);
+    fk.size = size;
+}
+
+// Applies a symmetric kernel of odd length m to y by overlap-save. Two
+// real blocks share each complex transform, one in each component.
+// out[i] is set for the centers m / 2 <= i < n - m / 2.
+template<typename T>
+void fft_filter(const T* y, size_t n, size_t m, const fft_kernel& fk, std::vector<complex>& buf, T* out) {
+    auto size = fk.size;
+    auto step = size - m + 1;
+    auto half = m / 2;
+    buf.resize(size);
+    for (size_t start = 0; start + m <= n; start += 2 * step) {
+        auto second = start + step;
+        for (size_t t = 0; t < size; t++) {
+            double re = start + t < n ? (double) y[start + t] : 0.0;
+            double im = second + t < n ? (double) y[second + t] : 0.0;
+            buf[t] = complex(re, im);
+        }
+        fft(buf.data(), size, fk.roots.data(), false);
+        for (size_t t = 0; t < size; t++) {
+            buf[t] = cmul(buf[t], fk.spectrum[t]);
+        }
+        fft(buf.data(), size, fk.roots.data(), true);
+        for (size_t t = m - 1; t < size; t++) {
+            if (start + t < n) {
+                out[start + t - half] = (T) buf[t].real();
+            }
+            if (second + t < n) {
+                out[second + t - half] = (T) buf[t].imag();
+            }
+        }
+    }
+}
+
+// Local fit at xs from the weighted sums of a window, with x measured
+// from xs. Returns the weighted mean for degree 0, or when the points are
+// too close together to estimate a slope.
+template<typename A>
+inline A loess_fit(A sw, A swx, A swxx, A swy, A swxy, bool linear, A range) {
+    auto ys = swy / sw;
+    if (linear) {
+        auto a = swx / sw; // weighted center of x values
+        auto c = swxx / sw - a * a;
+        if (std::sqrt(std::max(c, (A) 0.0)) > (A) 0.001 * range) {
+            // points are spread out enough to compute slope
+            auto b = -a / c;
+            ys += b * (swxy / sw - a * ys);
+        }
+    }
+    return ys;
+}
+
+// Kernel of a table in the accumulator type.
+template<typename A, typename T>
+const A* kernel_data(const tricube_table<T>& table) {
+    if constexpr (std::is_same_v<A, float>) {
+        return table.float_kernel.data();
+    } else {
+        return table.kernel.data();
+    }
+}
+
+template<typename T, typename A>
+bool est(const std::vector<T>& y, size_t n, size_t len, int ideg, T xs, T* ys, size_t nleft, size_t nright, bool userw, const std::vector<T>& rw, const tricube_table<T>* table = nullptr, size_t before = 0) {
+    // before counts the points of a longer series that precede y, whose
+    // range the slope of a window is tested against
+    A range = ((T) (n + before)) - 1.0;
+    auto h = std::max(xs - ((T) nleft), ((T) nright) - xs);
+
+    if (len > n) {
+        h += (T) ((len - n) / 2);
+    }
+
+    // accumulate the weighted sums in a single pass
+    auto s = tricube_sums(table != nullptr ? table->weights.data() : nullptr, (A) h, userw ? rw.data() + nleft - 1 : nullptr, y.data() + nleft - 1, nright - nleft + 1, (A) (((T) nleft) - xs), accumulate_in<A>());
+
+    if (s.sw <= 0.0) {
+        return false;
+    }
+
+    *ys = (T) loess_fit<A>(s.sw, s.swx, s.swxx, s.swy, s.swxy, h > 0.0 && ideg > 0, range);
+    return true;
+}
+
+// windows shorter than this are always smoothed with est
+constexpr size_t loess_moments_min_len = 64;
+
+// running moments pay off once the window is long relative to the jump
+inline bool use_loess_moments(size_t n, size_t len, size_t njump) {
+    auto win = std::min(len, n);
+    return win >= loess_moments_min_len && win >= 16 * njump;
+}
+
+// Loess smoothing from running polynomial moments.
+//
+// On either side of the fit point the tricube weight is a polynomial in
+// u = (j - xs) / h: (1 + u^3)^3 to the left and (1 - u^3)^3 to the right.
+// The sums est needs can therefore be built from the moments
+// sum(rw_j * s_j^q) and sum(rw_j * y_j * s_j^q) of each half window, which
+// are carried from one fit point to the next by adding and removing the
+// points that enter and leave. s_j is measured from a center that is reset
+// whenever the fit point enters a new cell of a quarter window, which keeps
+// the powers small and makes the state at a fit point independent of where
+// smoothing started. The y moments are taken about the value at the center,
+// reset along with it, since a local linear fit reproduces constants and
+// sums of large values would lose the variation of y to rounding. Results
+// match est to within 1e-8 of the spread of the data in double precision,
+// or to est's own rounding error of some tens of units in the last place
+// when the series is so far from zero that the values round coarser than
+// that, and to est's own rounding error in single precision.
+template<typename T>
+class loess_moments {
+public:
+    loess_moments(const std::vector<T>& y, size_t n, size_t len, bool userw, const std::vector<T>& rw, size_t before = 0) :
+        y_(y), rw_(rw), n_(n), len_(len), userw_(userw), before_(before) {
+        scale_ = std::max(1.0, (std::min(len, n) - 1) / 2.0);
+        cell_ = cell_size(n, len);
+    }
+
+    // cell of the fit point xs
+    static size_t cell(size_t n, size_t len, size_t xs) {
+        return (xs - 1) / cell_size(n, len);
+    }
+
+    // inlined into the smoothing loop, this runs noticeably slower
+    STL_NOINLINE bool fit(size_t xs, size_t nleft, size_t nright, int ideg, T* ys) {
+        advance(xs, nleft, nright);
+
+        double h = std::max(xs - nleft, nright - xs);
+        if (len_ > n_) {
+            h += (double) ((len_ - n_) / 2);
+        }
+        if (count_[0] + count_[1] == 0) {
+            return false;
+        }
+
+        // moments of the tricube weights in units of h about xs
+        auto alpha = scale_ / h;
+        auto beta = (center_ - (double) xs) / h;
+        double m[3] = {0.0, 0.0, 0.0};
+        double my[2] = {0.0, 0.0};
+        for (size_t side = 0; side < 2; side++) {
+            sums uw = shift(w_[side], alpha, beta, deg);
+            sums uy = shift(wy_[side], alpha, beta, deg - 1);
+            double sign = side == 0 ? 1.0 : -1.0;
+            double coef[4] = {1.0, 3.0 * sign, 3.0, sign};
+            for (size_t k = 0; k < 4; k++) {
+                for (size_t q = 0; q < 3; q++) {
+                    m[q] += coef[k] * uw[3 * k + q];
+                }
+                for (size_t q = 0; q < 2; q++) {
+                    my[q] += coef[k] * uy[3 * k + q];
+                }
+            }
+        }
+
+        if (m[0] <= 0.0) {
+            return false;
+        }
+
+        auto range = ((double) (n_ + before_)) - 1.0;
+        auto fit = loess_fit(m[0], h * m[1], h * h * m[2], my[0], h * my[1], ideg > 0, range);
+        *ys = (T) (fit + y_center_);
+        return true;
+    }
+
+private:
+    static size_t cell_size(size_t n, size_t len) {
+        return std::max((size_t) 1, (std::min(len, n) - 1) / 4);
+    }
+
+    static constexpr size_t deg = 11;
+    using sums = std::array<double, deg + 1>;
+
+    // moments about xs in units of h from moments about the center
+    static sums shift(const sums& s, double alpha, double beta, size_t maxq) {
+        static constexpr double binom[deg + 1][deg + 1] = {
+            {1},
+            {1, 1},
+            {1, 2, 1},
+            {1, 3, 3, 1},
+            {1, 4, 6, 4, 1},
+            {1, 5, 10, 10, 5, 1},
+            {1, 6, 15, 20, 15, 6, 1},
+            {1, 7, 21, 35, 35, 21, 7, 1},
+            {1, 8, 28, 56, 70, 56, 28, 8, 1},
+            {1, 9, 36, 84, 126, 126, 84, 36, 9, 1},
+            {1, 10, 45, 120, 210, 252, 210, 120, 45, 10, 1},
+            {1, 11, 55, 165, 330, 462, 462, 330, 165, 55, 11, 1}
+        };
+        double ap[deg + 1];
+        double bp[deg + 1];
+        ap[0] = 1.0;
+        bp[0] = 1.0;
+        for (size_t p = 1; p <= deg; p++) {
+            ap[p] = ap[p - 1] * alpha;
+            bp[p] = bp[p - 1] * beta;
+        }
+        sums u = {};
+        for (size_t q = 0; q <= maxq; q++) {
+            for (size_t p = 0; p <= q; p++) {
+                u[q] += binom[q][p] * ap[p] * bp[q - p] * s[p];
+            }
+        }
+        return u;
+    }
+
+    void update(size_t side, size_t j, double sign) {
+        double v = userw_ ? (double) rw_[j - 1] : 1.0;
+        if (v == 0.0) {
+            return;
+        }
+        double vy = v * ((double) y_[j - 1] - y_center_);
+        auto s = ((double) j - center_) / scale_;
+        double p = sign;
+        for (size_t q = 0; q <= deg; q++) {
+            w_[side][q] += p * v;
+            wy_[side][q] += p * vy;
+            p *= s;
+        }
+        count_[side] += sign > 0.0 ? 1 : -1;
+    }
+
+    void reset(size_t xs, size_t nleft, size_t nright) {
+        center_ = (double) xs;
+        y_center_ = std::isfinite((double) y_[xs - 1]) ? (double) y_[xs - 1] : 0.0;
+        w_[0].fill(0.0);
+        w_[1].fill(0.0);
+        wy_[0].fill(0.0);
+        wy_[1].fill(0.0);
+        count_[0] = 0;
+        count_[1] = 0;
+        for (auto j = nleft; j <= xs; j++) {
+            update(0, j, 1.0);
+        }
+        for (auto j = xs + 1; j <= nright; j++) {
+            update(1, j, 1.0);
+        }
+    }
+
+    // left half is [lo_, mid_] and right half is [mid_ + 1, hi_]
+    void advance(size_t xs, size_t nleft, size_t nright) {
+        auto cell = (xs - 1) / cell_;
+        if (!primed_ || cell != cell_index_ || nleft < lo_ || xs < mid_ || nright < hi_ || nleft > mid_ || xs > hi_) {
+            reset(xs, nleft, nright);
+            primed_ = true;
+            cell_index_ = cell;
+        } else {
+            for (auto j = lo_; j < nleft; j++) {
+                update(0, j, -1.0);
+            }
+            for (auto j = mid_ + 1; j <= xs; j++) {
+                update(0, j, 1.0);
+                update(1, j, -1.0);
+            }
+            for (auto j = hi_ + 1; j <= nright; j++) {
+                update(1, j, 1.0);
+            }
+        }
+        lo_ = nleft;
+        mid_ = xs;
+        hi_ = nright;
+    }
+
+    const std::vector<T>& y_;
+    const std::vector<T>& rw_;
+    size_t n_;
+    size_t len_;
+    bool userw_;
+    size_t before_;
+    double scale_;
+    size_t cell_;
+    double center_ = 0.0;
+    double y_center_ = 0.0;
+    size_t cell_index_ = 0;
+    bool primed_ = false;
+    size_t lo_ = 0;
+    size_t mid_ = 0;
+    size_t hi_ = 0;
+    sums w_[2] = {};
+    sums wy_[2] = {};
+    long count_[2] = {0, 0};
+};
+
+template<typename T>
+struct loess_scratch {
+    tricube_cache<T> cache;
+    std::vector<T> filtered;
+    std::vector<complex> buf;
+    std::vector<size_t> gaps;
+};
+
+// series at least this long may fit the points of a smoother on several
+// threads
+constexpr size_t parallel_ess_min_size = 1 << 16;
+
+// Fills the points between the fitted values at a and b with a straight
+// line.
+template<typename T>
+void interpolate(T* ys, size_t a, size_t b) {
+    auto delta = (ys[b - 1] - ys[a - 1]) / ((T) (b - a));
+    for (auto j = a + 1; j <= b - 1; j++) {
+        ys[j - 1] = ys[a - 1] + delta * ((T) (j - a));
+    }
+}
+
+// Fits the values at 1, 1 + newnj, ... in contiguous blocks on several
+// threads and interpolates between them, like the loops of ess. Blocks
+// start where the moments enter a new cell and are reset, so every block
+// reproduces the serial results. With gaps, the centered windows without
+// zero weights are filtered, as in ess.
+template<typename T, typename A>
+void ess_blocks(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t newnj, bool userw, const std::vector<T>& rw, T* ys, const tricube_table<T>* table, size_t threads, size_t before, const size_t* gaps) {
+    auto moments = use_loess_moments(n, len, newnj);
+    auto count = (n - 1) / newnj + 1;
+    threads = std::min(threads, count);
+
+    // window of the fitted value at i
+    auto nsh = (len + 1) / 2;
+    auto window = [&](size_t i) {
+        if (len >= n) {
+            return std::make_pair((size_t) 1, n);
+        } else if (i < nsh) {
+            return std::make_pair((size_t) 1, len);
+        } else if (i >= n - nsh + 1) {
+            return std::make_pair(n - len + 1, n);
+        } else {
+            return std::make_pair(i - nsh + 1, len + i - nsh);
+        }
+    };
+
+    std::vector<size_t> start(threads + 1, count);
+    start[0] = 0;
+    for (size_t t = 1; t < threads; t++) {
+        auto m = std::max(start[t - 1], t * count / threads);
+        while (moments && m > 0 && m < count && loess_moments<T>::cell(n, len, 1 + m * newnj) == loess_moments<T>::cell(n, len, 1 + (m - 1) * newnj)) {
+            m++;
+        }
+        start[t] = m;
+    }
+
+    parallel_invoke(threads, [&](size_t t) {
+        std::optional<loess_moments<T>> engine;
+        if (moments) {
+            engine.emplace(y, n, len, userw, rw, before);
+        }
+        for (auto m = start[t]; m < start[t + 1]; m++) {
+            auto i = 1 + m * newnj;
+            auto [nleft, nright] = window(i);
+            // interior windows are centered on the fit point
+            auto centered = table != nullptr && i - nleft == nright - i;
+            if (centered && (!userw || (gaps != nullptr && gaps[nright] == gaps[nleft - 1]))) {
+                ys[i - 1] = (T) filter_sum(kernel_data<A>(*table), y.data() + nleft - 1, len);
+                continue;
+            }
+            auto ok = engine ? engine->fit(i, nleft, nright, ideg, &ys[i - 1]) : est<T, A>(y, n, len, ideg, (T) i, &ys[i - 1], nleft, nright, userw, rw, centered ? table : nullptr, before);
+            if (!ok) {
+                ys[i - 1] = y[i - 1];
+            }
+        }
+        if (newnj != 1) {
+            for (auto m = start[t]; m + 1 < start[t + 1]; m++) {
+                interpolate(ys, 1 + m * newnj, 1 + (m + 1) * newnj);
+            }
+        }
+    });
+
+    // stitch the blocks together
+    if (newnj != 1) {
+        for (size_t t = 1; t < threads; t++) {
+            if (start[t] > 0 && start[t] < count) {
+                interpolate(ys, 1 + (start[t] - 1) * newnj, 1 + start[t] * newnj);
+            }
+        }
+    }
+
+    if (newnj != 1) {
+        auto k = ((n - 1) / newnj) * newnj + 1;
+        if (k != n) {
+            auto [nleft, nright] = window(k);
+            auto ok = est<T, A>(y, n, len, ideg, (T) n, &ys[n - 1], nleft, nright, userw, rw, nullptr, before);
+            if (!ok) {
+                ys[n - 1] = y[n - 1];
+            }
+            if (k != n - 1) {
+                interpolate(ys, k, n);
+            }
+        }
+    }
+}
+
+template<typename T, typename A>
+void ess(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t njump, bool userw, const std::vector<T>& rw, T* ys, loess_scratch<T>& scratch, size_t threads = 1, size_t before = 0, bool mask = false) {
+    if (n < 2) {
+        ys[0] = y[0];
+        return;
+    }
+
+    size_t nleft = 0;
+    size_t nright = 0;
+
+    auto newnj = std::min(njump, n - 1);
+
+    tricube_table<T>* table = nullptr;
+    if (len < n) {
+        table = &scratch.cache.get((T) ((len - 1) / 2), len);
+    }
+
+    // without robustness weights, centered windows are a plain filter, and
+    // so are those without zero weights when the weights only leave out
+    // missing values; gaps counts the zero weights before each point
+    auto masked = table != nullptr && userw && mask;
+    if (masked) {
+        scratch.gaps.resize(n + 1);
+        scratch.gaps[0] = 0;
+        for (size_t i = 0; i < n; i++) {
+            scratch.gaps[i + 1] = scratch.gaps[i] + (rw[i] == 0.0 ? 1 : 0);
+        }
+    }
+    auto filter = table != nullptr && (!userw || masked);
+    auto fft = filter && use_fft_filter(len, newnj);
+    if (threads > 1 && n >= parallel_ess_min_size && !fft) {
+        ess_blocks<T, A>(y, n, len, ideg, newnj, userw, rw, ys, table, threads, before, masked ? scratch.gaps.data() : nullptr);
+        return;
+    }
+
+    std::optional<loess_moments<T>> moments;
+    if (use_loess_moments(n, len, newnj)) {
+        moments.emplace(y, n, len, userw, rw, before);
+    }
+    if (fft) {
+        prepare_fft_kernel(table->kernel, table->fft);
+        scratch.filtered.resize(n);
+        fft_filter(y.data(), n, len, table->fft, scratch.buf, scratch.filtered.data());
+    }
+
+    auto fit = [&](size_t i) {
+        // interior windows are centered on the fit point
+        auto centered = table != nullptr && i - nleft == nright - i;
+        if (centered && filter && (!masked || scratch.gaps[nright] == scratch.gaps[nleft - 1])) {
+            ys[i - 1] = fft ? scratch.filtered[i - 1] : (T) filter_sum(kernel_data<A>(*table), y.data() + nleft - 1, len);
+            return;
+        }
+        auto ok = moments ? moments->fit(i, nleft, nright, ideg, &ys[i - 1]) : est<T, A>(y, n, len, ideg, (T) i, &ys[i - 1], nleft, nright, userw, rw, centered ? table : nullptr, before);
+        if (!ok) {
+            ys[i - 1] = y[i - 1];
+        }
+    };
+
+    if (len >= n) {
+        nleft = 1;
+        nright = n;
+        for (size_t i = 1; i <= n; i += newnj) {
+            fit(i);
+        }
+    } else if (newnj == 1) { // newnj equal to one, len less than n
+        auto nsh = (len + 1) / 2;
+        nleft = 1;
+        nright = len;
+        for (size_t i = 1; i <= n; i++) { // fitted value at i
+            if (i > nsh && nright != n) {
+                nleft += 1;
+                nright += 1;
+            }
+            fit(i);
+        }
+    } else { // newnj greater than one, len less than n
+        auto nsh = (len + 1) / 2;
+        for (size_t i = 1; i <= n; i += newnj) { // fitted value at i
+            if (i < nsh) {
+                nleft = 1;
+                nright = len;
+            } else if (i >= n - nsh + 1) {
+                nleft = n - len + 1;
+                nright = n;
+            } else {
+                nleft = i - nsh + 1;
+                nright = len + i - nsh;
+            }
+            fit(i);
+        }
+    }
+
+    if (newnj != 1) {
+        for (size_t i = 1; i <= n - newnj; i += newnj) {
+            auto delta = (ys[i + newnj - 1] - ys[i - 1]) / ((T) newnj);
+            for (auto j = i + 1; j <= i + newnj - 1; j++) {
+                ys[j - 1] = ys[i - 1] + delta * ((T) (j - i));
+            }
+        }
+        auto k = ((n - 1) / newnj) * newnj + 1;
+        if (k != n) {
+            auto ok = est<T, A>(y, n, len, ideg, (T) n, &ys[n - 1], nleft, nright, userw, rw, nullptr, before);
+            if (!ok) {
+                ys[n - 1] = y[n - 1];
+            }
+            if (k != n - 1) {
+                auto delta = (ys[n - 1] - ys[k - 1]) / ((T) (n - k));
+                for (auto j = k + 1; j <= n - 1; j++) {
+                    ys[j - 1] = ys[k - 1] + delta * ((T) (j - k));
+                }
+            }
+        }
+    }
+}
+
+template<typename T, typename A>
+void ma(const std::vector<T>& x, size_t n, size_t len, std::vector<T>& ave) {
+    moving_average(x.data(), n, len, ave.data(), accumulate_in<A>());
+}
+
+template<typename T, typename A>
+void fts(const std::vector<T>& x, size_t n, size_t np, std::vector<T>& trend, std::vector<T>& work) {
+    ma<T, A>(x, n, np, trend);
+    ma<T, A>(trend, n - np + 1, np, work);
+    ma<T, A>(work, n - 2 * np + 2, 3, trend);
+}
+
+// Sets rw to the robustness weights of the residuals of fit. Missing
+// values of y are left out of the median and get zero weight.
+template<typename T, typename A>
+void rwts(const T* y, size_t n, std::vector<T>& fit, std::vector<T>& rw, size_t threads, double scale, bool missing = false) {
+    // keep the residuals in fit and select from a copy in rw
+    size_t m = n;
+    if (missing) {
+        m = 0;
+        for (size_t i = 0; i < n; i++) {
+            fit[i] = std::abs(y[i] - fit[i]);
+            if (!std::isnan(fit[i])) {
+                rw[m++] = fit[i];
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            fit[i] = std::abs(y[i] - fit[i]);
+            rw[i] = fit[i];
+        }
+    }
+
+    // a positive scale from the caller replaces 6 * median abs resid
+    A cmad = (A) scale;
+    if (scale <= 0.0) {
+        auto mid1 = (m - 1) / 2;
+        auto mid2 = m / 2;
+
+        T r1;
+        T r2;
+        if (threads > 1 && m >= parallel_select_min_size) {
+            parallel_select(rw.data(), m, mid1, mid2, threads, &r1, &r2);
+        } else {
+            // both middle values from one selection
+            std::nth_element(rw.begin(), rw.begin() + mid2, rw.begin() + m);
+            r2 = rw[mid2];
+            r1 = mid1 == mid2 ? r2 : *std::max_element(rw.begin(), rw.begin() + mid2);
+        }
+        cmad = (A) 3.0 * (r1 + r2); // 6 * median abs resid
+    }
+
+    bisquare_weights(fit.data(), n, cmad, rw.data());
+
+    if (missing) {
+        for (size_t i = 0; i < n; i++) {
+            if (std::isnan(fit[i])) {
+                rw[i] = 0.0;
+            }
+        }
+    }
+}
+
+// Copies a series with missing (NaN) values to filled in one pass, with
+// each gap interpolated between the values on either side of it.
+template<typename T>
+void fill_missing(const T* y, size_t n, std::vector<T>& filled) {
+    filled.resize(n);
+    auto last = n; // last value seen, or n for none yet
+    for (size_t i = 0; i < n; i++) {
+        if (std::isnan(y[i])) {
+            continue;
+        }
+        filled[i] = y[i];
+        if (last + 1 < i || (last == n && i > 0)) {
+            for (auto j = last == n ? 0 : last + 1; j < i; j++) {
+                filled[j] = last == n ? y[i] : y[last] + (y[i] - y[last]) * (T) (j - last) / (T) (i - last);
+            }
+        }
+        last = i;
+    }
+    if (last == n) {
+        throw std::invalid_argument("series has no values");
+    }
+    for (auto j = last + 1; j < n; j++) {
+        filled[j] = y[last];
+    }
+}
+
+// Running estimate of a quantile in constant memory, by the P-square
+// algorithm of Jain and Chlamtac (1985). Five markers track the minimum,
+// the quantile, the maximum and two points between, and are moved along a
+// parabola through their neighbors as observations arrive.
+class p2_quantile {
+public:
+    explicit p2_quantile(double p) : p_(p) {
+        rate_ = {0.0, p / 2.0, p, (1.0 + p) / 2.0, 1.0};
+    }
+
+    void add(double x) {
+        if (count_ < 5) {
+            q_[count_] = x;
+            count_++;
+            if (count_ == 5) {
+                std::sort(q_.begin(), q_.end());
+                for (size_t i = 0; i < 5; i++) {
+                    pos_[i] = (double) i;
+                    want_[i] = 4.0 * rate_[i];
+                }
+            }
+            return;
+        }
+        count_++;
+
+        size_t k;
+        if (x < q_[0]) {
+            q_[0] = x;
+            k = 0;
+        } else if (x >= q_[4]) {
+            q_[4] = std::max(q_[4], x);
+            k = 3;
+        } else {
+            k = 0;
+            while (x >= q_[k + 1]) {
+                k++;
+            }
+        }
+        for (auto i = k + 1; i < 5; i++) {
+            pos_[i] += 1.0;
+        }
+        for (size_t i = 0; i < 5; i++) {
+            want_[i] += rate_[i];
+        }
+
+        for (size_t i = 1; i < 4; i++) {
+            auto d = want_[i] - pos_[i];
+            if ((d >= 1.0 && pos_[i + 1] - pos_[i] > 1.0) || (d <= -1.0 && pos_[i - 1] - pos_[i] < -1.0)) {
+                auto sign = d > 0.0 ? 1.0 : -1.0;
+                auto q = parabolic(i, sign);
+                if (q_[i - 1] < q && q < q_[i + 1]) {
+                    q_[i] = q;
+                } else {
+                    auto j = sign > 0.0 ? i + 1 : i - 1;
+                    q_[i] += sign * (q_[j] - q_[i]) / (pos_[j] - pos_[i]);
+                }
+                pos_[i] += sign;
+            }
+        }
+    }
+
+    size_t count() const {
+        return count_;
+    }
+
+    // exact for fewer than five observations
+    double value() const {
+        if (count_ >= 5) {
+            return q_[2];
+        }
+        if (count_ == 0) {
+            return 0.0;
+        }
+        std::array<double, 5> v = q_;
+        std::sort(v.begin(), v.begin() + count_);
+        return v[(size_t) (p_ * (double) (count_ - 1) + 0.5)];
+    }
+
+private:
+    double parabolic(size_t i, double d) const {
+        auto a = (pos_[i] - pos_[i - 1] + d) * (q_[i + 1] - q_[i]) / (pos_[i + 1] - pos_[i]);
+        auto b = (pos_[i + 1] - pos_[i] - d) * (q_[i] - q_[i - 1]) / (pos_[i] - pos_[i - 1]);
+        return q_[i] + d / (pos_[i + 1] - pos_[i - 1]) * (a + b);
+    }
+
+    double p_;
+    size_t count_ = 0;
+    std::array<double, 5> q_ = {};
+    std::array<double, 5> pos_ = {};
+    std::array<double, 5> want_ = {};
+    std::array<double, 5> rate_ = {};
+};
+
+// Scratch of a thread smoothing cycle-subseries.
+template<typename T>
+struct subseries_scratch {
+    std::vector<T> work1;
+    std::vector<T> work2;
+    std::vector<T> work3;
+    loess_scratch<T> loess;
+};
+
+// series at least this long may smooth cycle-subseries on several threads
+constexpr size_t parallel_ss_min_size = 1 << 14;
+
+// Smooths the cycle-subseries j1 to j2 of y, which follows before points of
+// a longer series.
+template<typename T, typename A>
+void ss_range(const std::vector<T>& y, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump, bool userw, const std::vector<T>& rw, std::vector<T>& season, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, loess_scratch<T>& scratch, size_t j1, size_t j2, size_t before = 0, bool mask = false) {
+    for (size_t j = j1; j <= j2; j++) {
+        size_t k = (n - j) / np + 1;
+        // points of the cycle-subseries in the longer series before y
+        auto skip = (before + j - 1) / np;
+
+        for (size_t i = 1; i <= k; i++) {
+            work1[i - 1] = y[(i - 1) * np + j - 1];
+        }
+        if (userw) {
+            for (size_t i = 1; i <= k; i++) {
+                work3[i - 1] = rw[(i - 1) * np + j - 1];
+            }
+        }
+        ess<T, A>(work1, k, ns, isdeg, nsjump, userw, work3, work2.data() + 1, scratch, 1, skip, mask);
+        T xs = 0.0;
+        auto nright = std::min(ns, k);
+        auto ok = est<T, A>(work1, k, ns, isdeg, xs, &work2[0], 1, nright, userw, work3, nullptr, skip);
+        if (!ok) {
+            work2[0] = work2[1];
+        }
+        xs = k + 1;
+        size_t nleft = (size_t) std::max(1, (int) k - (int) ns + 1);
+        ok = est<T, A>(work1, k, ns, isdeg, xs, &work2[k + 1], nleft, k, userw, work3, nullptr, skip);
+        if (!ok) {
+            work2[k + 1] = work2[k];
+        }
+        for (size_t m = 1; m <= k + 2; m++) {
+            season[(m - 1) * np + j - 1] = work2[m - 1];
+        }
+    }
+}
+
+template<typename T, typename A>
+void ss(const std::vector<T>& y, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump, bool userw, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, loess_scratch<T>& scratch, size_t threads, std::vector<subseries_scratch<T>>& subseries, size_t before = 0, bool mask = false) {
+    threads = std::min(threads, np);
+    if (threads <= 1 || n < parallel_ss_min_size) {
+        ss_range<T, A>(y, n, np, ns, isdeg, nsjump, userw, rw, season, work1, work2, work3, scratch, 1, np, before, mask);
+        return;
+    }
+
+    // each thread smooths a contiguous range of subseries, which write
+    // disjoint elements of season
+    subseries.resize(threads - 1);
+    for (auto& s : subseries) {
+        s.work1.resize((n - 1) / np + 3);
+        s.work2.resize((n - 1) / np + 3);
+        s.work3.resize((n - 1) / np + 3);
+    }
+    parallel_invoke(threads, [&](size_t t) {
+        auto j1 = t * np / threads + 1;
+        auto j2 = (t + 1) * np / threads;
+        if (t == 0) {
+            ss_range<T, A>(y, n, np, ns, isdeg, nsjump, userw, rw, season, work1, work2, work3, scratch, j1, j2, before, mask);
+        } else {
+            auto& s = subseries[t - 1];
+            ss_range<T, A>(y, n, np, ns, isdeg, nsjump, userw, rw, season, s.work1, s.work2, s.work3, s.loess, j1, j2, before, mask);
+        }
+    });
+}
+
+inline void check_stl(size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg) {
+    if (ns < 3) {
+        throw std::invalid_argument("seasonal_length must be at least 3");
+    }
+    if (nt < 3) {
+        throw std::invalid_argument("trend_length must be at least 3");
+    }
+    if (nl < 3) {
+        throw std::invalid_argument("low_pass_length must be at least 3");
+    }
+    if (np < 2) {
+        throw std::invalid_argument("period must be at least 2");
+    }
+
+    if (isdeg != 0 && isdeg != 1) {
+        throw std::invalid_argument("seasonal_degree must be 0 or 1");
+    }
+    if (itdeg != 0 && itdeg != 1) {
+        throw std::invalid_argument("trend_degree must be 0 or 1");
+    }
+    if (ildeg != 0 && ildeg != 1) {
+        throw std::invalid_argument("low_pass_degree must be 0 or 1");
+    }
+
+    if (ns % 2 != 1) {
+        throw std::invalid_argument("seasonal_length must be odd");
+    }
+    if (nt % 2 != 1) {
+        throw std::invalid_argument("trend_length must be odd");
+    }
+    if (nl % 2 != 1) {
+        throw std::invalid_argument("low_pass_length must be odd");
+    }
+}
+
+// Optional behavior of stl.
+struct stl_options {
+    // trend holds the trend to start from
+    bool warm_trend = false;
+    // rw holds the weights of the first pass
+    bool warm_weights = false;
+    // replaces 6 * median abs resid in the weights when positive
+    double scale = 0.0;
+    // stops the loops once changes are this small, relative to the range
+    // of the series for the fit
+    double tolerance = 0.0;
+    // rw is kept as the weights of the result, so it is set to 1 when
+    // there are no robustness iterations
+    bool weights = true;
+    // points of a longer series before y, which fits of its tail count in
+    // the range that loess tests the spread of a window against
+    size_t before = 0;
+};
+
+// Loops run by stl.
+struct stl_loops {
+    size_t inner = 0;
+    size_t outer = 0;
+};
+
+// An STL fit that runs in steps, so that callers can do other work
+// between them. Each step smooths a range of cycle-subseries, low-pass
+// filters them, smooths the trend to finish an inner loop, or updates the
+// robustness weights. The buffers must outlive the fit.
+template<typename T, typename A>
+class stl_fit {
+public:
+    stl_fit(const T* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, size_t no, size_t threads, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& trend, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, std::vector<T>& work4, std::vector<T>& work5, std::vector<T>& work6, loess_scratch<T>& scratch, std::vector<subseries_scratch<T>>& subseries, const stl_options& options) :
+        y_(y), n_(n), np_(np), ns_(ns), nt_(nt), nl_(nl), isdeg_(isdeg), itdeg_(itdeg), ildeg_(ildeg), nsjump_(nsjump), ntjump_(ntjump), nljump_(nljump), ni_(ni), no_(no), threads_(threads),
+        rw_(rw), season_(season), trend_(trend), work1_(work1), work2_(work2), work3_(work3), work4_(work4), work5_(work5), scratch_(scratch), subseries_(subseries), options_(options) {
+        check_stl(np, ns, nt, nl, isdeg, itdeg, ildeg);
+
+        // resizing only allocates when the buffers are smaller than the series
+        work1.resize(n + 2 * np);
+        work2.resize(n + 2 * np);
+        work3.resize(n + 2 * np);
+        work4.resize(n + 2 * np);
+        work5.resize(n + 2 * np);
+        rw.resize(n);
+        season.resize(n);
+        // a warm start passes the trend and weights to start from in trend and rw
+        if (!options.warm_trend) {
+            trend.assign(n, 0.0);
+        }
+
+        // the first loop is detrended in the same pass that looks for
+        // missing values
+        auto missing = false;
+        for (size_t i = 0; i < n; i++) {
+            missing |= std::isnan(y[i]);
+            work1[i] = y[i] - trend[i];
+        }
+        detrended_ = true;
+
+        // missing values have zero weight in every pass, and the loops see
+        // them filled in so that sums stay finite and a window with no values
+        // falls back to a nearby one
+        missing_ = missing;
+        values_ = y;
+        if (missing_) {
+            fill_missing(y, n, work6);
+            values_ = work6.data();
+            for (size_t i = 0; i < n; i++) {
+                work1[i] = values_[i] - trend[i];
+            }
+        }
+
+        // the tolerance scales with the range of the series, but is never
+        // below the rounding of its values, so that a constant series
+        // converges too
+        if (options.tolerance > 0.0) {
+            auto [lo, hi] = std::minmax_element(values_, values_ + n);
+            auto size = std::max(std::abs((double) *lo), std::abs((double) *hi));
+            tolerance_ = std::max(options.tolerance * ((double) *hi - (double) *lo), 16.0 * std::numeric_limits<T>::epsilon() * size);
+        }
+
+        userw_ = options.warm_weights;
+        if (missing_) {
+            if (!userw_) {
+                std::fill(rw.begin(), rw.end(), (T) 1.0);
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (std::isnan(y[i])) {
+                    rw[i] = 0.0;
+                }
+            }
+            userw_ = true;
+            // until the robustness weights are updated, they only leave out
+            // the missing values
+            mask_ = !options.warm_weights;
+        }
+    }
+
+    // Runs the next step, smoothing at most max_subseries cycle-subseries,
+    // and returns whether the fit is done.
+    bool step(size_t max_subseries) {
+        switch (phase_) {
+        case phase::subseries:
+            smooth_subseries(max_subseries);
+            return false;
+        case phase::low_pass:
+            smooth_low_pass();
+            return false;
+        case phase::trend:
+            finish_inner();
+            return phase_ == phase::done;
+        case phase::robust:
+            update_weights();
+            return false;
+        case phase::done:
+            break;
+        }
+        return true;
+    }
+
+    // Returns the loops run so far.
+    stl_loops loops() const {
+        return loops_;
+    }
+
+private:
+    enum class phase { subseries, low_pass, trend, robust, done };
+
+    void smooth_subseries(size_t max_subseries) {
+        auto n = n_;
+        if (next_ == 1 && !detrended_) {
+            for (size_t i = 0; i < n; i++) {
+                work1_[i] = values_[i] - trend_[i];
+            }
+        }
+        detrended_ = false;
+
+        if (next_ == 1 && max_subseries >= np_) {
+            ss<T, A>(work1_, n, np_, ns_, isdeg_, nsjump_, userw_, rw_, work2_, work3_, work4_, work5_, scratch_, threads_, subseries_, options_.before, mask_);
+            next_ = np_ + 1;
+        } else {
+            auto last = std::min(np_, next_ + std::max(max_subseries, (size_t) 1) - 1);
+            ss_range<T, A>(work1_, n, np_, ns_, isdeg_, nsjump_, userw_, rw_, work2_, work3_, work4_, work5_, scratch_, next_, last, options_.before, mask_);
+            next_ = last + 1;
+        }
+
+        if (next_ > np_) {
+            phase_ = phase::low_pass;
+        }
+    }
+
+    // Low-pass filters the smoothed cycle-subseries into work1.
+    void smooth_low_pass() {
+        fts<T, A>(work2_, n_ + 2 * np_, np_, work3_, work1_);
+        ess<T, A>(work3_, n_, nl_, ildeg_, nljump_, false, work4_, work1_.data(), scratch_, threads_, options_.before);
+        phase_ = phase::trend;
+    }
+
+    // Finishes an inner loop after the low-pass filter by smoothing the
+    // trend of the deseasonalized series. With a positive tolerance, stops
+    // the inner loops of the pass after one that changes trend + season by
+    // at most tolerance anywhere, and keeps the change of the first loop
+    // for the robustness check.
+    void finish_inner() {
+        auto n = n_;
+        auto np = np_;
+
+        // keep the previous fit in the free work arrays, which season holds
+        // after the first loop of all
+        auto track = options_.tolerance > 0.0 && (j_ > 0 || k_ > 0);
+        if (track) {
+            std::copy(season_.begin(), season_.begin() + n, work3_.begin());
+            std::copy(trend_.begin(), trend_.begin() + n, work5_.begin());
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            season_[i] = work2_[np + i] - work1_[i];
+        }
+        for (size_t i = 0; i < n; i++) {
+            work1_[i] = values_[i] - season_[i];
+        }
+        ess<T, A>(work1_, n, nt_, itdeg_, ntjump_, userw_, rw_, trend_.data(), scratch_, threads_, options_.before, mask_);
+        j_++;
+        next_ = 1;
+        phase_ = phase::subseries;
+
+        auto converged = false;
+        if (track) {
+            double delta = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                delta = std::max(delta, (double) std::abs(season_[i] - work3_[i] + trend_[i] - work5_[i]));
+            }
+            if (j_ == 1) {
+                change_ = delta;
+            }
+            converged = delta <= tolerance_;
+        }
+
+        if (j_ < ni_ && !converged) {
+            return;
+        }
+
+        // end of a pass
+        loops_.inner += j_;
+        j_ = 0;
+        k_ += 1;
+        if (k_ > no_) {
+            finish();
+        } else {
+            phase_ = phase::robust;
+        }
+    }
+
+    void update_weights() {
+        auto n = n_;
+        for (size_t i = 0; i < n; i++) {
+            work1_[i] = trend_[i] + season_[i];
+        }
+        if (options_.tolerance > 0.0) {
+            std::copy(rw_.begin(), rw_.begin() + n, work2_.begin());
+        }
+        rwts<T, A>(y_, n, work1_, rw_, threads_, options_.scale, missing_);
+        mask_ = false;
+        loops_.outer += 1;
+        phase_ = phase::subseries;
+
+        // converged once new weights barely move the fit and barely change
+        if (options_.tolerance > 0.0 && userw_ && change_ <= tolerance_) {
+            double delta = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                delta = std::max(delta, (double) std::abs(rw_[i] - work2_[i]));
+            }
+            if (delta <= options_.tolerance) {
+                // keep the weights the components were fitted with
+                std::copy(work2_.begin(), work2_.begin() + n, rw_.begin());
+                finish();
+                return;
+            }
+        }
+        userw_ = true;
+        change_ = std::numeric_limits<double>::infinity();
+    }
+
+    void finish() {
+        if (options_.weights && no_ <= 0 && !options_.warm_weights && !missing_) {
+            for (size_t i = 0; i < n_; i++) {
+                rw_[i] = 1.0;
+            }
+        }
+        phase_ = phase::done;
+    }
+
+    const T* y_;
+    const T* values_;
+    size_t n_, np_, ns_, nt_, nl_;
+    int isdeg_, itdeg_, ildeg_;
+    size_t nsjump_, ntjump_, nljump_, ni_, no_, threads_;
+    std::vector<T>& rw_;
+    std::vector<T>& season_;
+    std::vector<T>& trend_;
+    std::vector<T>& work1_;
+    std::vector<T>& work2_;
+    std::vector<T>& work3_;
+    std::vector<T>& work4_;
+    std::vector<T>& work5_;
+    loess_scratch<T>& scratch_;
+    std::vector<subseries_scratch<T>>& subseries_;
+    stl_options options_;
+
+    bool missing_ = false;
+    bool mask_ = false;
+    bool detrended_ = false;
+    bool userw_ = false;
+    double tolerance_ = 0.0;
+    phase phase_ = phase::subseries;
+    size_t next_ = 1; // next cycle-subseries to smooth
+    size_t j_ = 0; // inner loops run in this pass
+    size_t k_ = 0; // passes run
+    double change_ = std::numeric_limits<double>::infinity();
+    stl_loops loops_;
+};
+
+template<typename T, typename A>
+stl_loops stl(const T* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, size_t no, size_t threads, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& trend, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, std::vector<T>& work4, std::vector<T>& work5, std::vector<T>& work6, loess_scratch<T>& scratch, std::vector<subseries_scratch<T>>& subseries, const stl_options& options = stl_options()) {
+    stl_fit<T, A> fit(y, n, np, ns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no, threads, rw, season, trend, work1, work2, work3, work4, work5, work6, scratch, subseries, options);
+    while (!fit.step(np)) {
+    }
+    return fit.loops();
+}
+
+template<typename T>
+double strength(const std::vector<T>& component, const std::vector<T>& remainder) {
+    if (component.size() != remainder.size()) {
+        throw std::invalid_argument("component and remainder must have the same length");
+    }
+    moments r;
+    moments cr;
+    component_moments(component.data(), remainder.data(), remainder.size(), &r, cr);
+    return strength(r, cr);
+}
+
+// Smoother settings resolved from a set of parameters and a period.
+struct stl_settings {
+    size_t np;
+    size_t ns;
+    size_t nt;
+    size_t nl;
+    int isdeg;
+    int itdeg;
+    int ildeg;
+    size_t nsjump;
+    size_t ntjump;
+    size_t nljump;
+    size_t ni;
+    size_t no;
+};
+
+}
+
+/// Applies the Box-Cox transformation with a lambda to a series, writing to
+/// out, which may be the series.
+template<typename T>
+void box_cox(const T* series, size_t series_size, float lambda, T* out) {
+    box_cox_values(series, series_size, lambda, out);
+}
+
+/// Applies the Box-Cox transformation with a lambda to a series.
+template<typename T>
+std::vector<T> box_cox(const std::vector<T>& series, float lambda) {
+    std::vector<T> res(series.size());
+    box_cox_values(series.data(), series.size(), lambda, res.data());
+    return res;
+}
+
+/// Inverts the Box-Cox transformation with a lambda in place, such as to
+/// bring the trend, or the trend plus the seasonal component, of a fit with
+/// the lambda back to the scale of the series.
+template<typename T>
+void inv_box_cox(T* values, size_t size, float lambda) {
+    inv_box_cox_values(values, size, lambda);
+}
+
+/// Inverts the Box-Cox transformation with a lambda in place.
+template<typename T>
+void inv_box_cox(std::vector<T>& values, float lambda) {
+    inv_box_cox_values(values.data(), values.size(), lambda);
+}
+
+/// Outputs of a fit, which combine with `|` to select the parts of a
+/// result to compute.
+namespace output {
+
+/// The seasonal component.
+constexpr unsigned seasonal = 1 << 0;
+
+/// The trend component.
+constexpr unsigned trend = 1 << 1;
+
+/// The remainder.
+constexpr unsigned remainder = 1 << 2;
+
+/// The robustness weights.
+constexpr unsigned weights = 1 << 3;
+
+/// The seasonal and trend strengths.
+constexpr unsigned strengths = 1 << 4;
+
+/// Every output. This is the default.
+constexpr unsigned all = seasonal | trend | remainder | weights | strengths;
+
+}
+
+/// A STL result.
+template<typename T = float>
+class StlResult {
+public:
+    /// Returns the seasonal component.
+    std::vector<T> seasonal;
+
+    /// Returns the trend component.
+    std::vector<T> trend;
+
+    /// Returns the remainder.
+    std::vector<T> remainder;
+
+    /// Returns the weights.
+    std::vector<T> weights;
+
+    /// Returns the number of inner loops run, over all passes.
+    size_t inner_loops = 0;
+
+    /// Returns the number of robustness iterations run.
+    size_t outer_loops = 0;
+
+    /// @private
+    std::optional<double> seasonal_strength_ = std::nullopt;
+
+    /// @private
+    std::optional<double> trend_strength_ = std::nullopt;
+
+    /// Returns the seasonal strength.
+    inline double seasonal_strength() const {
+        return seasonal_strength_.has_value() ? seasonal_strength_.value() : strength(seasonal, remainder);
+    }
+
+    /// Returns the trend strength.
+    inline double trend_strength() const {
+        return trend_strength_.has_value() ? trend_strength_.value() : strength(trend, remainder);
+    }
+
+    /// @private
+    /// Computes the remainder and strengths of a finished fit of y and
+    /// drops the components left out of outputs. A remainder that is not
+    /// kept is written to scratch.
+    void finish(const T* y, unsigned outputs, std::vector<T>& scratch) {
+        auto n = seasonal.size();
+        seasonal_strength_ = std::nullopt;
+        trend_strength_ = std::nullopt;
+        if (outputs & output::strengths) {
+            auto& r = (outputs & output::remainder) ? remainder : scratch;
+            r.resize(n);
+            moments rm;
+            moments sr;
+            moments tr;
+            remainder_moments(y, seasonal.data(), trend.data(), n, r.data(), rm, sr, tr);
+            seasonal_strength_ = strength(rm, sr);
+            trend_strength_ = strength(rm, tr);
+        } else if (outputs & output::remainder) {
+            remainder.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                remainder[i] = y[i] - seasonal[i] - trend[i];
+            }
+        }
+
+        // cleared buffers keep their capacity for the next fit in a workspace
+        if (!(outputs & output::seasonal)) {
+            seasonal.clear();
+        }
+        if (!(outputs & output::trend)) {
+            trend.clear();
+        }
+        if (!(outputs & output::remainder)) {
+            remainder.clear();
+        }
+        if (!(outputs & output::weights)) {
+            weights.clear();
+        }
+    }
+};
+
+/// A result of decomposing a batch of time series. Components are laid
+/// out like the input, with the values of every series at a point next to
+/// each other.
+template<typename T = float>
+class StlBatchResult {
+public:
+    /// Returns the number of series.
+    size_t num_series = 0;
+
+    /// Returns the size of each series.
+    size_t series_size = 0;
+
+    /// Returns the seasonal components.
+    std::vector<T> seasonal;
+
+    /// Returns the trend components.
+    std::vector<T> trend;
+
+    /// Returns the remainders.
+    std::vector<T> remainder;
+
+    /// Returns the weights.
+    std::vector<T> weights;
+
+    /// Returns the number of inner loops run for each series.
+    size_t inner_loops = 0;
+
+    /// Returns the number of robustness iterations run for each series.
+    size_t outer_loops = 0;
+
+    /// Returns the result for one series.
+    inline StlResult<T> series(size_t index) const {
+        auto column = [&](const std::vector<T>& v) {
+            std::vector<T> c(series_size);
+            for (size_t i = 0; i < series_size; i++) {
+                c[i] = v[i * num_series + index];
+            }
+            return c;
+        };
+        return StlResult<T> {column(seasonal), column(trend), column(remainder), column(weights), inner_loops, outer_loops};
+    }
+};
+
+/// Precision policies for fits, which choose the type sums are accumulated in.
+namespace precision {
+
+/// Stores values in the series type and accumulates sums in double. This is
+/// the default.
+struct mixed {
+    /// @private
+    template<typename T>
+    using accumulator = double;
+};
+
+/// Accumulates sums in the series type. For float series this uses twice
+/// the SIMD lanes of mixed, with components within about 1e-4 of the data
+/// scale. Running-moment smoothing of long windows and FFT filtering still
+/// use double.
+struct fast_float {
+    /// @private
+    template<typename T>
+    using accumulator = T;
+};
+
+}
+
+class StlParams;
+
+template<typename T = float>
+class StlStream;
+
+template<typename T = float, typename P = precision::mixed>
+class StlFit;
+
+/// A reusable set of buffers for STL fits.
+///
+/// A fit of a series no larger than a previous fit (or the reserved size) with
+/// the same smoothing lengths does not allocate.
+template<typename T = float>
+class StlWorkspace {
+    friend class StlParams;
+    template<typename>
+    friend class StlStream;
+    template<typename, typename>
+    friend class StlFit;
+
+    std::vector<T> work1_;
+    std::vector<T> work2_;
+    std::vector<T> work3_;
+    std::vector<T> work4_;
+    std::vector<T> work5_;
+    std::vector<T> work6_;
+    std::vector<T> series_;
+    loess_scratch<T> scratch_;
+    std::vector<subseries_scratch<T>> subseries_;
+    StlResult<T> result_;
+
+public:
+    /// Reserves buffers for series up to a size and period.
+    inline void reserve(size_t series_size, size_t period) {
+        for (auto* work : {&work1_, &work2_, &work3_, &work4_, &work5_}) {
+            work->reserve(series_size + 2 * period);
+        }
+        work6_.reserve(series_size);
+        result_.seasonal.reserve(series_size);
+        result_.trend.reserve(series_size);
+        result_.remainder.reserve(series_size);
+        result_.weights.reserve(series_size);
+    }
+
+    /// Returns the result of the last fit.
+    inline const StlResult<T>& result() const {
+        return result_;
+    }
+};
+
+/// A set of STL parameters.
+class StlParams {
+public:
+    /// @private
+    std::optional<size_t> ns_ = std::nullopt;
+private:
+    std::optional<size_t> nt_ = std::nullopt;
+    std::optional<size_t> nl_ = std::nullopt;
+    int isdeg_ = 0;
+    int itdeg_ = 1;
+    std::optional<int> ildeg_ = std::nullopt;
+    std::optional<size_t> nsjump_ = std::nullopt;
+    std::optional<size_t> ntjump_ = std::nullopt;
+    std::optional<size_t> nljump_ = std::nullopt;
+    std::optional<size_t> ni_ = std::nullopt;
+    std::optional<size_t> no_ = std::nullopt;
+    bool robust_ = false;
+    size_t threads_ = 1;
+    std::optional<std::vector<double>> initial_trend_ = std::nullopt;
+    std::optional<std::vector<double>> initial_weights_ = std::nullopt;
+    std::optional<double> tolerance_ = std::nullopt;
+    unsigned outputs_ = output::all;
+    std::optional<float> lambda_ = std::nullopt;
+
+    template<typename>
+    friend class StlStream;
+    template<typename, typename>
+    friend class StlFit;
+
+    // Checks a fit of a series and seeds trend and weights with the initial
+    // trend and weights, unless options already start from others.
+    template<typename T>
+    stl_options start_fit(size_t series_size, size_t period, std::vector<T>& trend, std::vector<T>& weights, stl_options options = stl_options()) const;
+
+public:
+    /// @private
+    stl_settings settings(size_t period) const;
+
+    /// @private
+    stl_settings settings(size_t period, size_t seasonal_length) const;
+
+    /// @private
+    /// Fits a series with the given settings into seasonal, trend and
+    /// weights, without a result. A warm start passes the trend and weights
+    /// to start from in trend and weights.
+    template<typename T, typename P = precision::mixed>
+    stl_loops fit_components(const T* series, size_t series_size, const stl_settings& settings, std::vector<T>& seasonal, std::vector<T>& trend, std::vector<T>& weights, stl_options options, StlWorkspace<T>& workspace) const;
+
+    /// Sets the length of the seasonal smoother.
+    inline StlParams seasonal_length(size_t length) {
+        this->ns_ = length;
+        return *this;
+    }
+
+    /// Sets the length of the trend smoother.
+    inline StlParams trend_length(size_t length) {
+        this->nt_ = length;
+        return *this;
+    }
+
+    /// Sets the length of the low-pass filter.
+    inline StlParams low_pass_length(size_t length) {
+        this->nl_ = length;
+        return *this;
+    }
+
+    /// Sets the degree of locally-fitted polynomial in seasonal smoothing.
+    inline StlParams seasonal_degree(int degree) {
+        this->isdeg_ = degree;
+        return *this;
+    }
+
+    /// Sets the degree of locally-fitted polynomial in trend smoothing.
+    inline StlParams trend_degree(int degree) {
+        this->itdeg_ = degree;
+        return *this;
+    }
+
+    /// Sets the degree of locally-fitted polynomial in low-pass smoothing.
+    inline StlParams low_pass_degree(int degree) {
+        this->ildeg_ = degree;
+        return *this;
+    }
+
+    /// Sets the skipping value for seasonal smoothing.
+    inline StlParams seasonal_jump(size_t jump) {
+        this->nsjump_ = jump;
+        return *this;
+    }
+
+    /// Sets the skipping value for trend smoothing.
+    inline StlParams trend_jump(size_t jump) {
+        this->ntjump_ = jump;
+        return *this;
+    }
+
+    /// Sets the skipping value for low-pass smoothing.
+    inline StlParams low_pass_jump(size_t jump) {
+        this->nljump_ = jump;
+        return *this;
+    }
+
+    /// Sets the number of loops for updating the seasonal and trend components.
+    inline StlParams inner_loops(size_t loops) {
+        this->ni_ = loops;
+        return *this;
+    }
+
+    /// Sets the number of iterations of robust fitting.
+    inline StlParams outer_loops(size_t loops) {
+        this->no_ = loops;
+        return *this;
+    }
+
+    /// Sets whether robustness iterations are to be used.
+    inline StlParams robust(bool robust) {
+        this->robust_ = robust;
+        return *this;
+    }
+
+    /// Sets the number of threads a single decomposition may use.
+    inline StlParams threads(size_t threads) {
+        this->threads_ = std::max(threads, (size_t) 1);
+        return *this;
+    }
+
+    /// Sets the trend to start from instead of zero, such as the trend of a
+    /// previous fit of a similar series. A good start needs fewer inner loops.
+    template<typename T>
+    inline StlParams initial_trend(const std::vector<T>& trend) {
+        this->initial_trend_ = std::vector<double>(trend.begin(), trend.end());
+        return *this;
+    }
+
+    /// Sets the robustness weights of the first pass, such as the weights of
+    /// a previous robust fit. Good weights need fewer outer loops.
+    template<typename T>
+    inline StlParams initial_weights(const std::vector<T>& weights) {
+        this->initial_weights_ = std::vector<double>(weights.begin(), weights.end());
+        return *this;
+    }
+
+    /// Stops the loops early once they converge: an inner loop once it changes
+    /// trend + season by at most tolerance times the range of the series, or
+    /// by rounding error when that is larger, and the robustness iterations
+    /// once new weights change by at most tolerance and barely move the fit.
+    /// The loops run are reported in the result.
+    inline StlParams tolerance(double tolerance) {
+        this->tolerance_ = tolerance;
+        return *this;
+    }
+
+    /// Sets the outputs of fits, such as `output::remainder | output::strengths`.
+    /// Components left out are not computed or are left empty, and strengths
+    /// left out are computed from the components when asked for. Streams
+    /// keep every output.
+    inline StlParams outputs(unsigned outputs) {
+        this->outputs_ = outputs;
+        return *this;
+    }
+
+    /// Sets lambda for Box-Cox transformation. Fits decompose the transformed
+    /// series, and `inv_box_cox` brings their components back to the scale
+    /// of the series. MSTL takes lambda from its own parameters.
+    inline StlParams lambda(float lambda) {
+        this->lambda_ = lambda;
+        return *this;
+    }
+
+    /// Decomposes a time series from an array. P is a precision policy, such
+    /// as `fit<float, stl::precision::fast_float>`. Missing values are NaN:
+    /// they get zero weight, and their remainder is NaN.
+    template<typename T, typename P = precision::mixed>
+    StlResult<T> fit(const T* series, size_t series_size, size_t period) const;
+
+    /// Decomposes a time series from a vector.
+    template<typename T, typename P = precision::mixed>
+    StlResult<T> fit(const std::vector<T>& series, size_t period) const;
+
+    /// Decomposes a time series from an array, reusing the buffers of a workspace.
+    /// The result is owned by the workspace and is overwritten by its next fit.
+    template<typename T, typename P = precision::mixed>
+    const StlResult<T>& fit(const T* series, size_t series_size, size_t period, StlWorkspace<T>& workspace) const;
+
+    /// Decomposes a time series from a vector, reusing the buffers of a workspace.
+    template<typename T, typename P = precision::mixed>
+    const StlResult<T>& fit(const std::vector<T>& series, size_t period, StlWorkspace<T>& workspace) const;
+
+    /// Decomposes a batch of time series of the same size and period. The
+    /// matrix holds the values of every series at the first point, then at
+    /// the second point, and so on.
+    template<typename T>
+    StlBatchResult<T> fit_batch(const T* matrix, size_t num_series, size_t series_size, size_t period) const;
+
+#if __cplusplus >= 202002L
+    /// Decomposes a time series from a span.
+    template<typename T, typename P = precision::mixed>
+    StlResult<T> fit(std::span<const T> series, size_t period) const;
+#endif
+};
+
+/// Creates a new set of STL parameters.
+inline StlParams params() {
+    return StlParams();
+}
+
+inline stl_settings StlParams::settings(size_t period) const {
+    return settings(period, this->ns_.value_or(period));
+}
+
+inline stl_settings StlParams::settings(size_t period, size_t seasonal_length) const {
+    auto np = period;
+    auto ns = seasonal_length;
+
+    auto isdeg = this->isdeg_;
+    auto itdeg = this->itdeg_;
+
+    auto ildeg = this->ildeg_.value_or(itdeg);
+    auto newns = std::max(ns, (size_t) 3);
+    if (newns % 2 == 0) {
+        newns += 1;
+    }
+
+    auto newnp = std::max(np, (size_t) 2);
+    auto nt = (size_t) ceil((1.5 * newnp) / (1.0 - 1.5 / (float) newns));
+    nt = this->nt_.value_or(nt);
+    nt = std::max(nt, (size_t) 3);
+    if (nt % 2 == 0) {
+        nt += 1;
+    }
+
+    auto nl = this->nl_.value_or(newnp);
+    if (nl % 2 == 0 && !this->nl_.has_value()) {
+        nl += 1;
+    }
+
+    auto ni = this->ni_.value_or(this->robust_ ? 1 : 2);
+    auto no = this->no_.value_or(this->robust_ ? 15 : 0);
+
+    auto nsjump = this->nsjump_.value_or((size_t) ceil(((float) newns) / 10.0));
+    auto ntjump = this->ntjump_.value_or((size_t) ceil(((float) nt) / 10.0));
+    auto nljump = this->nljump_.value_or((size_t) ceil(((float) nl) / 10.0));
+
+    return stl_settings {newnp, newns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no};
+}
+
+template<typename T, typename P>
+StlResult<T> StlParams::fit(const T* series, size_t series_size, size_t period) const {
+    StlWorkspace<T> workspace;
+    fit<T, P>(series, series_size, period, workspace);
+    auto res = std::move(workspace.result_);
+    // components left out give their buffers back with the workspace
+    for (auto* component : {&res.seasonal, &res.trend, &res.remainder, &res.weights}) {
+        if (component->empty()) {
+            component->shrink_to_fit();
+        }
+    }
+    return res;
+}
+
+template<typename T>
+stl_options StlParams::start_fit(size_t series_size, size_t period, std::vector<T>& trend, std::vector<T>& weights, stl_options options) const {
+    auto np = period;
+    auto n = series_size;
+
+    if (n < 2 * np) {
+        throw std::invalid_argument("series has less than two periods");
+    }
+
+    if (initial_trend_ && initial_trend_->size() != n) {
+        throw std::invalid_argument("initial_trend must have the same length as series");
+    }
+    if (initial_weights_ && initial_weights_->size() != n) {
+        throw std::invalid_argument("initial_weights must have the same length as series");
+    }
+    if (tolerance_ && !(*tolerance_ >= 0.0)) {
+        throw std::invalid_argument("tolerance must not be negative");
+    }
+    if (lambda_ && !(*lambda_ >= 0.0 && *lambda_ <= 1.0)) {
+        throw std::invalid_argument("lambda must be between 0 and 1");
+    }
+
+    if (initial_trend_ && !options.warm_trend) {
+        trend.assign(initial_trend_->begin(), initial_trend_->end());
+        options.warm_trend = true;
+    }
+    if (initial_weights_ && !options.warm_weights) {
+        weights.assign(initial_weights_->begin(), initial_weights_->end());
+        options.warm_weights = true;
+    }
+
+    options.tolerance = tolerance_.value_or(0.0);
+    return options;
+}
+
+template<typename T, typename P>
+stl_loops StlParams::fit_components(const T* series, size_t series_size, const stl_settings& settings, std::vector<T>& seasonal, std::vector<T>& trend, std::vector<T>& weights, stl_options options, StlWorkspace<T>& workspace) const {
+    auto& s = settings;
+    options = start_fit(series_size, s.np, trend, weights, options);
+    return stl<T, typename P::template accumulator<T>>(series, series_size, s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg, s.nsjump, s.ntjump, s.nljump, s.ni, s.no, this->threads_, weights, seasonal, trend, workspace.work1_, workspace.work2_, workspace.work3_, workspace.work4_, workspace.work5_, workspace.work6_, workspace.scratch_, workspace.subseries_, options);
+}
+
+template<typename T, typename P>
+const StlResult<T>& StlParams::fit(const T* series, size_t series_size, size_t period, StlWorkspace<T>& workspace) const {
+    auto y = series;
+    auto np = period;
+    auto n = series_size;
+
+    auto& res = workspace.result_;
+    auto options = start_fit(n, np, res.trend, res.weights);
+    options.weights = (outputs_ & output::weights) != 0;
+    auto s = this->settings(np);
+
+    if (lambda_) {
+        workspace.series_.resize(n);
+        box_cox_series(series, n, *lambda_, workspace.series_.data());
+        y = workspace.series_.data();
+    }
+
+    auto loops = stl<T, typename P::template accumulator<T>>(y, n, s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg, s.nsjump, s.ntjump, s.nljump, s.ni, s.no, this->threads_, res.weights, res.seasonal, res.trend, workspace.work1_, workspace.work2_, workspace.work3_, workspace.work4_, workspace.work5_, workspace.work6_, workspace.scratch_, workspace.subseries_, options);
+    res.inner_loops = loops.inner;
+    res.outer_loops = loops.outer;
+    res.finish(y, outputs_, workspace.work1_);
+
+    return res;
+}
+
+template<typename T, typename P>
+StlResult<T> StlParams::fit(const std::vector<T>& series, size_t period) const {
+    return StlParams::fit<T, P>(series.data(), series.size(), period);
+}
+
+template<typename T, typename P>
+const StlResult<T>& StlParams::fit(const std::vector<T>& series, size_t period, StlWorkspace<T>& workspace) const {
+    return StlParams::fit<T, P>(series.data(), series.size(), period, workspace);
+}
+
+#if __cplusplus >= 202002L
+template<typename T, typename P>
+StlResult<T> StlParams::fit(std::span<const T> series, size_t period) const {
+    return StlParams::fit<T, P>(series.data(), series.size(), period);
+}
+#endif
+
+namespace {
+
 template<typename T>
-bool est(const std::vector<T>& y, size_t n, size_t len, int ideg, T xs, T* ys, size_t nleft, size_t nright, std::vector<T>& w, bool userw, const std::vector<T>& rw) {
+void batch_est(const std::vector<T>& y, size_t n, size_t len, int ideg, T xs, T* ys, size_t nleft, size_t nright, bool userw, const std::vector<T>& rw, const T* fallback, const tricube_table<T>* table = nullptr) {
     auto range = ((T) n) - 1.0;
     auto h = std::max(xs - ((T) nleft), ((T) nright) - xs);
 
@@ -41,67 +2847,30 @@ bool est(const std::vector<T>& y, size_t n, size_t len, int ideg, T xs, T* ys, s
         h += (T) ((len - n) / 2);
     }
 
-    auto h9 = 0.999 * h;
-    auto h1 = 0.001 * h;
+    window_sums<> s[batch_lanes];
+    batch_tricube_sums(table != nullptr ? table->weights.data() : nullptr, (double) h, userw ? rw.data() + (nleft - 1) * batch_lanes : nullptr, y.data() + (nleft - 1) * batch_lanes, nright - nleft + 1, (double) (((T) nleft) - xs), s);
 
-    // compute weights
-    auto a = 0.0;
-    for (auto j = nleft; j <= nright; j++) {
-        w[j - 1] = 0.0;
-        auto r = std::abs(((T) j) - xs);
-        if (r <= h9) {
-            if (r <= h1) {
-                w[j - 1] = 1.0;
-            } else {
-                w[j - 1] = (T) std::pow(1.0 - std::pow(r / h, 3), 3);
-            }
-            if (userw) {
-                w[j - 1] *= rw[j - 1];
-            }
-            a += w[j - 1];
-        }
+    // lanes without weight keep the fallback value
+    for (size_t l = 0; l < batch_lanes; l++) {
+        ys[l] = s[l].sw <= 0.0 ? fallback[l] : (T) loess_fit(s[l].sw, s[l].swx, s[l].swxx, s[l].swy, s[l].swxy, h > 0.0 && ideg > 0, range);
     }
+}
 
-    if (a <= 0.0) {
-        return false;
-    } else { // weighted least squares
-        for (auto j = nleft; j <= nright; j++) { // make sum of w(j) == 1
-            w[j - 1] /= (T) a;
-        }
-
-        if (h > 0.0 && ideg > 0) { // use linear fit
-            auto a = 0.0;
-            for (auto j = nleft; j <= nright; j++) { // weighted center of x values
-                a += w[j - 1] * ((T) j);
-            }
-            auto b = xs - a;
-            auto c = 0.0;
-            for (auto j = nleft; j <= nright; j++) {
-                c += w[j - 1] * std::pow(((T) j) - a, 2);
-            }
-            if (std::sqrt(c) > 0.001 * range) {
-                b /= c;
-
-                // points are spread out enough to compute slope
-                for (auto j = nleft; j <= nright; j++) {
-                    w[j - 1] *= (T) (b * (((T) j) - a) + 1.0);
-                }
-            }
-        }
-
-        *ys = 0.0;
-        for (auto j = nleft; j <= nright; j++) {
-            *ys += w[j - 1] * y[j - 1];
+// Fills the points between a and b with a straight line.
+template<typename T>
+void batch_interpolate(T* ys, size_t a, size_t b) {
+    for (size_t l = 0; l < batch_lanes; l++) {
+        auto delta = (ys[(b - 1) * batch_lanes + l] - ys[(a - 1) * batch_lanes + l]) / ((T) (b - a));
+        for (auto j = a + 1; j <= b - 1; j++) {
+            ys[(j - 1) * batch_lanes + l] = ys[(a - 1) * batch_lanes + l] + delta * ((T) (j - a));
         }
-
-        return true;
     }
 }
 
 template<typename T>
-void ess(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t njump, bool userw, const std::vector<T>& rw, T* ys, std::vector<T>& res) {
+void batch_ess(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t njump, bool userw, const std::vector<T>& rw, T* ys, tricube_cache<T>& cache) {
     if (n < 2) {
-        ys[0] = y[0];
+        std::copy(y.begin(), y.begin() + batch_lanes, ys);
         return;
     }
 
@@ -109,14 +2878,27 @@ void ess(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t njump,
     size_t nright = 0;
 
     auto newnj = std::min(njump, n - 1);
+
+    tricube_table<T>* table = nullptr;
+    if (len < n) {
+        table = &cache.get((T) ((len - 1) / 2), len);
+    }
+
+    auto fit = [&](size_t i) {
+        auto centered = table != nullptr && i - nleft == nright - i;
+        auto out = ys + (i - 1) * batch_lanes;
+        if (centered && !userw) {
+            batch_filter_sum(table->kernel.data(), y.data() + (nleft - 1) * batch_lanes, len, out);
+            return;
+        }
+        batch_est(y, n, len, ideg, (T) i, out, nleft, nright, userw, rw, y.data() + (i - 1) * batch_lanes, centered ? table : nullptr);
+    };
+
     if (len >= n) {
         nleft = 1;
         nright = n;
         for (size_t i = 1; i <= n; i += newnj) {
-            auto ok = est(y, n, len, ideg, (T) i, &ys[i - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[i - 1] = y[i - 1];
-            }
+            fit(i);
         }
     } else if (newnj == 1) { // newnj equal to one, len less than n
         auto nsh = (len + 1) / 2;
@@ -127,10 +2909,7 @@ void ess(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t njump,
                 nleft += 1;
                 nright += 1;
             }
-            auto ok = est(y, n, len, ideg, (T) i, &ys[i - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[i - 1] = y[i - 1];
-            }
+            fit(i);
         }
     } else { // newnj greater than one, len less than n
         auto nsh = (len + 1) / 2;
@@ -145,442 +2924,558 @@ void ess(const std::vector<T>& y, size_t n, size_t len, int ideg, size_t njump,
                 nleft = i - nsh + 1;
                 nright = len + i - nsh;
             }
-            auto ok = est(y, n, len, ideg, (T) i, &ys[i - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[i - 1] = y[i - 1];
-            }
+            fit(i);
         }
     }
 
     if (newnj != 1) {
         for (size_t i = 1; i <= n - newnj; i += newnj) {
-            auto delta = (ys[i + newnj - 1] - ys[i - 1]) / ((T) newnj);
-            for (auto j = i + 1; j <= i + newnj - 1; j++) {
-                ys[j - 1] = ys[i - 1] + delta * ((T) (j - i));
-            }
+            batch_interpolate(ys, i, i + newnj);
         }
         auto k = ((n - 1) / newnj) * newnj + 1;
         if (k != n) {
-            auto ok = est(y, n, len, ideg, (T) n, &ys[n - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[n - 1] = y[n - 1];
-            }
+            batch_est(y, n, len, ideg, (T) n, ys + (n - 1) * batch_lanes, nleft, nright, userw, rw, y.data() + (n - 1) * batch_lanes);
             if (k != n - 1) {
-                auto delta = (ys[n - 1] - ys[k - 1]) / ((T) (n - k));
-                for (auto j = k + 1; j <= n - 1; j++) {
-                    ys[j - 1] = ys[k - 1] + delta * ((T) (j - k));
-                }
+                batch_interpolate(ys, k, n);
             }
         }
     }
 }
 
 template<typename T>
-void ma(const std::vector<T>& x, size_t n, size_t len, std::vector<T>& ave) {
-    auto newn = n - len + 1;
-    double flen = (T) len;
-    double v = 0.0;
-
-    // get the first average
-    for (size_t i = 0; i < len; i++) {
-        v += x[i];
-    }
-
-    ave[0] = (T) (v / flen);
-    if (newn > 1) {
-        size_t k = len;
-        size_t m = 0;
-        for (size_t j = 1; j < newn; j++) {
-            // window down the array
-            v = v - x[m] + x[k];
-            ave[j] = (T) (v / flen);
-            k += 1;
-            m += 1;
-        }
-    }
-}
-
-template<typename T>
-void fts(const std::vector<T>& x, size_t n, size_t np, std::vector<T>& trend, std::vector<T>& work) {
-    ma(x, n, np, trend);
-    ma(trend, n - np + 1, np, work);
-    ma(work, n - 2 * np + 2, 3, trend);
+void batch_fts(const std::vector<T>& x, size_t n, size_t np, std::vector<T>& trend, std::vector<T>& work) {
+    batch_moving_average(x.data(), n, np, trend.data());
+    batch_moving_average(trend.data(), n - np + 1, np, work.data());
+    batch_moving_average(work.data(), n - 2 * np + 2, 3, trend.data());
 }
 
+// Robustness weights of every lane from the median of its own residuals.
 template<typename T>
-void rwts(const T* y, size_t n, const std::vector<T>& fit, std::vector<T>& rw) {
-    for (size_t i = 0; i < n; i++) {
-        rw[i] = std::abs(y[i] - fit[i]);
+void batch_rwts(const T* y, size_t n, std::vector<T>& fit, std::vector<T>& rw, std::vector<T>& work) {
+    for (size_t i = 0; i < n * batch_lanes; i++) {
+        fit[i] = std::abs(y[i] - fit[i]);
     }
 
     auto mid1 = (n - 1) / 2;
     auto mid2 = n / 2;
 
-    // sort
-    std::sort(rw.begin(), rw.begin() + n);
-
-    auto cmad = 3.0 * (rw[mid1] + rw[mid2]); // 6 * median abs resid
-    auto c9 = 0.999 * cmad;
-    auto c1 = 0.001 * cmad;
+    double cmad[batch_lanes];
+    for (size_t l = 0; l < batch_lanes; l++) {
+        for (size_t i = 0; i < n; i++) {
+            work[i] = fit[i * batch_lanes + l];
+        }
+        std::nth_element(work.begin(), work.begin() + mid2, work.begin() + n);
+        auto r2 = work[mid2];
+        auto r1 = mid1 == mid2 ? r2 : *std::max_element(work.begin(), work.begin() + mid2);
+        cmad[l] = 3.0 * (r1 + r2); // 6 * median abs resid
+    }
 
     for (size_t i = 0; i < n; i++) {
-        auto r = std::abs(y[i] - fit[i]);
-        if (r <= c1) {
-            rw[i] = 1.0;
-        } else if (r <= c9) {
-            rw[i] = (T) std::pow(1.0 - std::pow(r / cmad, 2), 2);
-        } else {
-            rw[i] = 0.0;
+        for (size_t l = 0; l < batch_lanes; l++) {
+            double r = fit[i * batch_lanes + l];
+            auto u = r / cmad[l];
+            auto t = 1.0 - u * u;
+            rw[i * batch_lanes + l] = r <= 0.001 * cmad[l] ? 1.0 : (r <= 0.999 * cmad[l] ? (T) (t * t) : 0.0);
         }
     }
 }
 
 template<typename T>
-void ss(const std::vector<T>& y, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump, bool userw, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, std::vector<T>& work4) {
+void batch_ss(const std::vector<T>& y, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump, bool userw, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, tricube_cache<T>& cache) {
+    auto lanes = [](std::vector<T>& v, size_t i) {
+        return v.data() + i * batch_lanes;
+    };
+
     for (size_t j = 1; j <= np; j++) {
         size_t k = (n - j) / np + 1;
 
         for (size_t i = 1; i <= k; i++) {
-            work1[i - 1] = y[(i - 1) * np + j - 1];
+            std::copy_n(y.data() + ((i - 1) * np + j - 1) * batch_lanes, batch_lanes, lanes(work1, i - 1));
         }
         if (userw) {
             for (size_t i = 1; i <= k; i++) {
-                work3[i - 1] = rw[(i - 1) * np + j - 1];
+                std::copy_n(lanes(rw, (i - 1) * np + j - 1), batch_lanes, lanes(work3, i - 1));
             }
         }
-        ess(work1, k, ns, isdeg, nsjump, userw, work3, work2.data() + 1, work4);
-        T xs = 0.0;
+        batch_ess(work1, k, ns, isdeg, nsjump, userw, work3, lanes(work2, 1), cache);
         auto nright = std::min(ns, k);
-        auto ok = est(work1, k, ns, isdeg, xs, &work2[0], 1, nright, work4, userw, work3);
-        if (!ok) {
-            work2[0] = work2[1];
-        }
-        xs = k + 1;
+        batch_est(work1, k, ns, isdeg, (T) 0.0, lanes(work2, 0), 1, nright, userw, work3, lanes(work2, 1));
         size_t nleft = (size_t) std::max(1, (int) k - (int) ns + 1);
-        ok = est(work1, k, ns, isdeg, xs, &work2[k + 1], nleft, k, work4, userw, work3);
-        if (!ok) {
-            work2[k + 1] = work2[k];
-        }
+        batch_est(work1, k, ns, isdeg, (T) (k + 1), lanes(work2, k + 1), nleft, k, userw, work3, lanes(work2, k));
         for (size_t m = 1; m <= k + 2; m++) {
-            season[(m - 1) * np + j - 1] = work2[m - 1];
+            std::copy_n(lanes(work2, m - 1), batch_lanes, lanes(season, (m - 1) * np + j - 1));
         }
     }
 }
 
 template<typename T>
-void onestp(const T* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, bool userw, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& trend, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, std::vector<T>& work4, std::vector<T>& work5) {
+void batch_onestp(const std::vector<T>& y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, bool userw, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& trend, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, std::vector<T>& work4, std::vector<T>& work5, tricube_cache<T>& cache) {
+    auto size = n * batch_lanes;
     for (size_t j = 0; j < ni; j++) {
-        for (size_t i = 0; i < n; i++) {
+        for (size_t i = 0; i < size; i++) {
             work1[i] = y[i] - trend[i];
         }
 
-        ss(work1, n, np, ns, isdeg, nsjump, userw, rw, work2, work3, work4, work5, season);
-        fts(work2, n + 2 * np, np, work3, work1);
-        ess(work3, n, nl, ildeg, nljump, false, work4, work1.data(), work5);
-        for (size_t i = 0; i < n; i++) {
-            season[i] = work2[np + i] - work1[i];
+        batch_ss(work1, n, np, ns, isdeg, nsjump, userw, rw, work2, work3, work4, work5, cache);
+        batch_fts(work2, n + 2 * np, np, work3, work1);
+        batch_ess(work3, n, nl, ildeg, nljump, false, work4, work1.data(), cache);
+        for (size_t i = 0; i < size; i++) {
+            season[i] = work2[np * batch_lanes + i] - work1[i];
         }
-        for (size_t i = 0; i < n; i++) {
+        for (size_t i = 0; i < size; i++) {
             work1[i] = y[i] - season[i];
         }
-        ess(work1, n, nt, itdeg, ntjump, userw, rw, trend.data(), work3);
+        batch_ess(work1, n, nt, itdeg, ntjump, userw, rw, trend.data(), cache);
     }
 }
 
+// STL on batch_lanes series at once. Every lane follows the control flow
+// of stl with direct loess sums, so lanes agree with a separate fit of
+// their series to rounding.
 template<typename T>
-void stl(const T* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, size_t no, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& trend) {
-    if (ns < 3) {
-        throw std::invalid_argument("seasonal_length must be at least 3");
-    }
-    if (nt < 3) {
-        throw std::invalid_argument("trend_length must be at least 3");
-    }
-    if (nl < 3) {
-        throw std::invalid_argument("low_pass_length must be at least 3");
-    }
-    if (np < 2) {
-        throw std::invalid_argument("period must be at least 2");
-    }
-
-    if (isdeg != 0 && isdeg != 1) {
-        throw std::invalid_argument("seasonal_degree must be 0 or 1");
-    }
-    if (itdeg != 0 && itdeg != 1) {
-        throw std::invalid_argument("trend_degree must be 0 or 1");
-    }
-    if (ildeg != 0 && ildeg != 1) {
-        throw std::invalid_argument("low_pass_degree must be 0 or 1");
-    }
-
-    if (ns % 2 != 1) {
-        throw std::invalid_argument("seasonal_length must be odd");
-    }
-    if (nt % 2 != 1) {
-        throw std::invalid_argument("trend_length must be odd");
-    }
-    if (nl % 2 != 1) {
-        throw std::invalid_argument("low_pass_length must be odd");
-    }
-
-    auto work1 = std::vector<T>(n + 2 * np);
-    auto work2 = std::vector<T>(n + 2 * np);
-    auto work3 = std::vector<T>(n + 2 * np);
-    auto work4 = std::vector<T>(n + 2 * np);
-    auto work5 = std::vector<T>(n + 2 * np);
+void batch_stl(const std::vector<T>& y, size_t n, const stl_settings& s, std::vector<T>& rw, std::vector<T>& season, std::vector<T>& trend, std::vector<T>& work1, std::vector<T>& work2, std::vector<T>& work3, std::vector<T>& work4, std::vector<T>& work5, tricube_cache<T>& cache) {
+    std::fill(trend.begin(), trend.end(), 0.0);
 
     auto userw = false;
     size_t k = 0;
 
     while (true) {
-        onestp(y, n, np, ns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, userw, rw, season, trend, work1, work2, work3, work4, work5);
+        batch_onestp(y, n, s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg, s.nsjump, s.ntjump, s.nljump, s.ni, userw, rw, season, trend, work1, work2, work3, work4, work5, cache);
         k += 1;
-        if (k > no) {
+        if (k > s.no) {
             break;
         }
-        for (size_t i = 0; i < n; i++) {
+        for (size_t i = 0; i < n * batch_lanes; i++) {
             work1[i] = trend[i] + season[i];
         }
-        rwts(y, n, work1, rw);
+        batch_rwts(y.data(), n, work1, rw, work2);
         userw = true;
     }
 
-    if (no <= 0) {
-        for (size_t i = 0; i < n; i++) {
-            rw[i] = 1.0;
-        }
-    }
-}
-
-template<typename T>
-double var(const std::vector<T>& series) {
-    auto mean = std::accumulate(series.begin(), series.end(), 0.0) / series.size();
-    double sum = 0.0;
-    for (auto v : series) {
-        double diff = v - mean;
-        sum += diff * diff;
-    }
-    return sum / (series.size() - 1);
-}
-
-template<typename T>
-double strength(const std::vector<T>& component, const std::vector<T>& remainder) {
-    std::vector<T> sr;
-    sr.reserve(remainder.size());
-    for (size_t i = 0; i < remainder.size(); i++) {
-        sr.push_back(component[i] + remainder[i]);
+    if (s.no <= 0) {
+        std::fill(rw.begin(), rw.end(), 1.0);
     }
-    return std::max(0.0, 1.0 - var(remainder) / var(sr));
 }
 
 }
 
-/// A STL result.
-template<typename T = float>
-class StlResult {
-public:
-    /// Returns the seasonal component.
-    std::vector<T> seasonal;
+template<typename T>
+StlBatchResult<T> StlParams::fit_batch(const T* matrix, size_t num_series, size_t series_size, size_t period) const {
+    auto np = period;
+    auto n = series_size;
 
-    /// Returns the trend component.
-    std::vector<T> trend;
+    if (n < 2 * np) {
+        throw std::invalid_argument("series has less than two periods");
+    }
 
-    /// Returns the remainder.
-    std::vector<T> remainder;
+    auto s = this->settings(np);
+    check_stl(s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg);
+    if (initial_trend_ || initial_weights_) {
+        throw std::invalid_argument("initial_trend and initial_weights are not supported by fit_batch");
+    }
+    if (tolerance_) {
+        throw std::invalid_argument("tolerance is not supported by fit_batch");
+    }
+    if (outputs_ != output::all) {
+        throw std::invalid_argument("outputs are not supported by fit_batch");
+    }
+    if (lambda_) {
+        throw std::invalid_argument("lambda is not supported by fit_batch");
+    }
+    if (std::any_of(matrix, matrix + n * num_series, [](T v) { return std::isnan(v); })) {
+        throw std::invalid_argument("missing values are not supported by fit_batch");
+    }
 
-    /// Returns the weights.
-    std::vector<T> weights;
+    StlBatchResult<T> res;
+    res.num_series = num_series;
+    res.series_size = n;
+    res.inner_loops = s.ni * (s.no + 1);
+    res.outer_loops = s.no;
+    res.seasonal.resize(n * num_series);
+    res.trend.resize(n * num_series);
+    res.remainder.resize(n * num_series);
+    res.weights.resize(n * num_series);
+
+    auto size = n * batch_lanes;
+    auto work_size = (n + 2 * s.np) * batch_lanes;
+    std::vector<T> y(size);
+    std::vector<T> rw(size);
+    std::vector<T> season(size);
+    std::vector<T> trend(size);
+    std::vector<T> work1(work_size);
+    std::vector<T> work2(work_size);
+    std::vector<T> work3(work_size);
+    std::vector<T> work4(work_size);
+    std::vector<T> work5(work_size);
+    tricube_cache<T> cache;
+
+    for (size_t first = 0; first < num_series; first += batch_lanes) {
+        auto count = std::min(batch_lanes, num_series - first);
+
+        // unused lanes repeat the last series of the group
+        for (size_t i = 0; i < n; i++) {
+            for (size_t l = 0; l < batch_lanes; l++) {
+                y[i * batch_lanes + l] = matrix[i * num_series + first + std::min(l, count - 1)];
+            }
+        }
 
-    /// Returns the seasonal strength.
-    inline double seasonal_strength() const {
-        return strength(seasonal, remainder);
-    }
+        batch_stl(y, n, s, rw, season, trend, work1, work2, work3, work4, work5, cache);
 
-    /// Returns the trend strength.
-    inline double trend_strength() const {
-        return strength(trend, remainder);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t l = 0; l < count; l++) {
+                auto from = i * batch_lanes + l;
+                auto to = i * num_series + first + l;
+                res.seasonal[to] = season[from];
+                res.trend[to] = trend[from];
+                res.remainder[to] = y[from] - season[from] - trend[from];
+                res.weights[to] = rw[from];
+            }
+        }
     }
-};
 
-/// A set of STL parameters.
-class StlParams {
-public:
-    /// @private
-    std::optional<size_t> ns_ = std::nullopt;
-private:
-    std::optional<size_t> nt_ = std::nullopt;
-    std::optional<size_t> nl_ = std::nullopt;
-    int isdeg_ = 0;
-    int itdeg_ = 1;
-    std::optional<int> ildeg_ = std::nullopt;
-    std::optional<size_t> nsjump_ = std::nullopt;
-    std::optional<size_t> ntjump_ = std::nullopt;
-    std::optional<size_t> nljump_ = std::nullopt;
-    std::optional<size_t> ni_ = std::nullopt;
-    std::optional<size_t> no_ = std::nullopt;
-    bool robust_ = false;
+    return res;
+}
+
+namespace {
 
+// Tasks of one worker of fit_ragged. The worker takes tasks from the
+// front and idle workers steal from the back.
+class task_deque {
 public:
-    /// Sets the length of the seasonal smoother.
-    inline StlParams seasonal_length(size_t length) {
-        this->ns_ = length;
-        return *this;
+    void push(size_t task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
     }
 
-    /// Sets the length of the trend smoother.
-    inline StlParams trend_length(size_t length) {
-        this->nt_ = length;
-        return *this;
+    bool pop(size_t& task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty()) {
+            return false;
+        }
+        task = tasks_.front();
+        tasks_.pop_front();
+        return true;
     }
 
-    /// Sets the length of the low-pass filter.
-    inline StlParams low_pass_length(size_t length) {
-        this->nl_ = length;
-        return *this;
+    bool steal(size_t& task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty()) {
+            return false;
+        }
+        task = tasks_.back();
+        tasks_.pop_back();
+        return true;
     }
 
-    /// Sets the degree of locally-fitted polynomial in seasonal smoothing.
-    inline StlParams seasonal_degree(int degree) {
-        this->isdeg_ = degree;
-        return *this;
-    }
+private:
+    std::mutex mutex_;
+    std::deque<size_t> tasks_;
+};
 
-    /// Sets the degree of locally-fitted polynomial in trend smoothing.
-    inline StlParams trend_degree(int degree) {
-        this->itdeg_ = degree;
-        return *this;
-    }
+}
 
-    /// Sets the degree of locally-fitted polynomial in low-pass smoothing.
-    inline StlParams low_pass_degree(int degree) {
-        this->ildeg_ = degree;
-        return *this;
+/// Decomposes a batch of time series of different sizes on several threads.
+/// Series i holds values offsets[i] to offsets[i + 1] - 1 and is fit with
+/// periods[i] and params[i]. Results are the same for any number of threads.
+template<typename T>
+std::vector<StlResult<T>> fit_ragged(const T* values, const size_t* offsets, size_t num_series, const size_t* periods, const StlParams* params, size_t threads) {
+    std::vector<StlResult<T>> results(num_series);
+
+    // longest first, dealt out in turn
+    std::vector<size_t> order(num_series);
+    std::vector<double> cost(num_series);
+    for (size_t i = 0; i < num_series; i++) {
+        auto s = params[i].settings(periods[i]);
+        order[i] = i;
+        cost[i] = (double) (offsets[i + 1] - offsets[i]) * (double) (s.ni * (s.no + 1));
     }
+    std::stable_sort(order.begin(), order.end(), [&cost](size_t a, size_t b) {
+        return cost[a] > cost[b];
+    });
 
-    /// Sets the skipping value for seasonal smoothing.
-    inline StlParams seasonal_jump(size_t jump) {
-        this->nsjump_ = jump;
-        return *this;
+    threads = std::max((size_t) 1, std::min(threads, num_series));
+    std::vector<task_deque> deques(threads);
+    for (size_t i = 0; i < num_series; i++) {
+        deques[i % threads].push(order[i]);
     }
 
-    /// Sets the skipping value for trend smoothing.
-    inline StlParams trend_jump(size_t jump) {
-        this->ntjump_ = jump;
-        return *this;
-    }
+    // the error of the first failing series is reported whatever the
+    // thread count
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    size_t error_index = num_series;
+
+    parallel_invoke(threads, [&](size_t t) {
+        StlWorkspace<T> workspace;
+        size_t i;
+        while (true) {
+            auto found = deques[t].pop(i);
+            for (size_t o = 1; !found && o < threads; o++) {
+                found = deques[(t + o) % threads].steal(i);
+            }
+            if (!found) {
+                break;
+            }
 
-    /// Sets the skipping value for low-pass smoothing.
-    inline StlParams low_pass_jump(size_t jump) {
-        this->nljump_ = jump;
-        return *this;
+            try {
+                results[i] = params[i].fit(values + offsets[i], offsets[i + 1] - offsets[i], periods[i], workspace);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (i < error_index) {
+                    error = std::current_exception();
+                    error_index = i;
+                }
+            }
+        }
+    });
+
+    if (error) {
+        std::rethrow_exception(error);
     }
 
-    /// Sets the number of loops for updating the seasonal and trend components.
-    inline StlParams inner_loops(size_t loops) {
-        this->ni_ = loops;
-        return *this;
+    return results;
+}
+
+/// Decomposes a batch of time series of different sizes on several threads.
+template<typename T>
+std::vector<StlResult<T>> fit_ragged(const std::vector<T>& values, const std::vector<size_t>& offsets, const std::vector<size_t>& periods, const std::vector<StlParams>& params, size_t threads) {
+    if (offsets.empty() || offsets.back() > values.size() || !std::is_sorted(offsets.begin(), offsets.end())) {
+        throw std::invalid_argument("offsets do not match values");
     }
+    auto num_series = offsets.size() - 1;
+    if (periods.size() != num_series || params.size() != num_series) {
+        throw std::invalid_argument("periods and params must have one entry per series");
+    }
+    return fit_ragged(values.data(), offsets.data(), num_series, periods.data(), params.data(), threads);
+}
 
-    /// Sets the number of iterations of robust fitting.
-    inline StlParams outer_loops(size_t loops) {
-        this->no_ = loops;
-        return *this;
+/// A decomposition that runs in steps, for callers that must return control
+/// between them, such as a NIF that yields to its scheduler. A step smooths
+/// some cycle-subseries, low-pass filters them, smooths the trend, or
+/// updates the robustness weights, and the result matches StlParams::fit.
+template<typename T, typename P>
+class StlFit {
+public:
+    /// Starts a decomposition of a copy of a series.
+    StlFit(const StlParams& params, const T* series, size_t series_size, size_t period) : series_(series, series + series_size), outputs_(params.outputs_) {
+        auto& res = workspace_.result_;
+        auto options = params.start_fit(series_size, period, res.trend, res.weights);
+        options.weights = (outputs_ & output::weights) != 0;
+        auto s = params.settings(period);
+        if (params.lambda_) {
+            box_cox_series(series_.data(), series_size, *params.lambda_, series_.data());
+        }
+        fit_.emplace(series_.data(), series_size, s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg, s.nsjump, s.ntjump, s.nljump, s.ni, s.no, params.threads_, res.weights, res.seasonal, res.trend, workspace_.work1_, workspace_.work2_, workspace_.work3_, workspace_.work4_, workspace_.work5_, workspace_.work6_, workspace_.scratch_, workspace_.subseries_, options);
     }
 
-    /// Sets whether robustness iterations are to be used.
-    inline StlParams robust(bool robust) {
-        this->robust_ = robust;
-        return *this;
+    /// Starts a decomposition of a copy of a series.
+    StlFit(const StlParams& params, const std::vector<T>& series, size_t period) : StlFit(params, series.data(), series.size(), period) {}
+
+    StlFit(const StlFit&) = delete;
+    StlFit& operator=(const StlFit&) = delete;
+
+    /// Runs the next step, smoothing at most max_subseries cycle-subseries,
+    /// and returns whether the decomposition is done.
+    bool step(size_t max_subseries = 1) {
+        if (!done_ && fit_->step(max_subseries)) {
+            auto& res = workspace_.result_;
+            auto loops = fit_->loops();
+            res.inner_loops = loops.inner;
+            res.outer_loops = loops.outer;
+            res.finish(series_.data(), outputs_, workspace_.work1_);
+            done_ = true;
+        }
+        return done_;
     }
 
-    /// Decomposes a time series from an array.
-    template<typename T>
-    StlResult<T> fit(const T* series, size_t series_size, size_t period) const;
+    /// Returns whether the decomposition is done.
+    inline bool done() const {
+        return done_;
+    }
 
-    /// Decomposes a time series from a vector.
-    template<typename T>
-    StlResult<T> fit(const std::vector<T>& series, size_t period) const;
+    /// Returns the result, once the decomposition is done.
+    inline const StlResult<T>& result() const {
+        return workspace_.result_;
+    }
 
-#if __cplusplus >= 202002L
-    /// Decomposes a time series from a span.
-    template<typename T>
-    StlResult<T> fit(std::span<const T> series, size_t period) const;
-#endif
+private:
+    std::vector<T> series_;
+    unsigned outputs_;
+    StlWorkspace<T> workspace_;
+    std::optional<stl_fit<T, typename P::template accumulator<T>>> fit_;
+    bool done_ = false;
 };
 
-/// Creates a new set of STL parameters.
-inline StlParams params() {
-    return StlParams();
-}
-
+/// An STL decomposition of a growing series.
+///
+/// Appending points refits only the tail of the series they can change,
+/// which follows from the smoothing lengths and jumps, so the cost of an
+/// update does not depend on how many points came before. Older points keep
+/// the components they had when they left the tail. Without robustness, the
+/// components match a fit of the whole series, except where loess falls
+/// back from a linear to a constant fit: as in the reference STL, it does so
+/// when the x values of a window spread less than a thousandth of the
+/// length of the series, which grows after a point is final. With
+/// robustness, the weights are scaled by a running median of the residuals
+/// of older points instead of the median of the refit points, and the outer
+/// loops spread changes further than the reach, so the components only
+/// approximate those of a fit of the whole series.
 template<typename T>
-StlResult<T> StlParams::fit(const T* series, size_t series_size, size_t period) const {
-    auto y = series;
-    auto np = period;
-    auto n = series_size;
-
-    if (n < 2 * np) {
-        throw std::invalid_argument("series has less than two periods");
+class StlStream {
+public:
+    /// Creates a stream for a period. At least the last history points are
+    /// kept, or every point when history is 0.
+    StlStream(const StlParams& params, size_t period, size_t history = 0) :
+        params_(params), period_(period), settings_(params.settings(period)), scale_(0.5) {
+        auto& s = settings_;
+        check_stl(s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg);
+        if (params.initial_trend_ || params.initial_weights_) {
+            throw std::invalid_argument("initial_trend and initial_weights are not supported by streams");
+        }
+        if (params.tolerance_ && !(*params.tolerance_ >= 0.0)) {
+            throw std::invalid_argument("tolerance must not be negative");
+        }
+        if (params.lambda_) {
+            throw std::invalid_argument("lambda is not supported by streams");
+        }
+        // a point changes the fits of its cycle-subseries within ns points,
+        // which the low-pass filter and the trend smoother spread further,
+        // and each inner loop spreads the trend of the last one as far again
+        reach_ = ((s.ns + s.nsjump) * s.np + 2 * s.np + s.nl + s.nljump + s.nt + s.ntjump) * s.ni;
+        // period of the grids of points that smoothers fit rather than
+        // interpolate
+        align_ = std::lcm(s.np * s.nsjump, std::lcm(s.ntjump, s.nljump));
+        history_ = history == 0 ? 0 : std::max(history, 2 * reach_ + align_);
     }
 
-    auto ns = this->ns_.value_or(np);
+    /// Appends a point.
+    inline void push(T value) {
+        push_many(&value, 1);
+    }
 
-    auto isdeg = this->isdeg_;
-    auto itdeg = this->itdeg_;
+    /// Appends points from an array.
+    void push_many(const T* values, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        series_.insert(series_.end(), values, values + count);
+        update();
+        trim();
+    }
 
-    auto res = StlResult<T> {
-        std::vector<T>(n),
-        std::vector<T>(n),
-        std::vector<T>(),
-        std::vector<T>(n)
-    };
+    /// Appends points from a vector.
+    inline void push_many(const std::vector<T>& values) {
+        push_many(values.data(), values.size());
+    }
 
-    auto ildeg = this->ildeg_.value_or(itdeg);
-    auto newns = std::max(ns, (size_t) 3);
-    if (newns % 2 == 0) {
-        newns += 1;
+    /// Returns the number of points kept.
+    inline size_t size() const {
+        return series_.size();
     }
 
-    auto newnp = std::max(np, (size_t) 2);
-    auto nt = (size_t) ceil((1.5 * newnp) / (1.0 - 1.5 / (float) newns));
-    nt = this->nt_.value_or(nt);
-    nt = std::max(nt, (size_t) 3);
-    if (nt % 2 == 0) {
-        nt += 1;
+    /// Returns the number of trailing points a new point can change.
+    inline size_t reach() const {
+        return reach_;
     }
 
-    auto nl = this->nl_.value_or(newnp);
-    if (nl % 2 == 0 && !this->nl_.has_value()) {
-        nl += 1;
+    /// Returns the estimated cost of appending count points, in points
+    /// refit times loops, which grows with the square of the period.
+    inline size_t cost(size_t count) const {
+        auto n = series_.size() + count;
+        if (n < 2 * period_) {
+            return 0;
+        }
+        // an update refits from up to two reaches and a grid period before
+        // the points fitted so far
+        auto fitted = result_.trend.size();
+        auto context = 2 * reach_ + align_;
+        auto start = fitted < context ? 0 : fitted - context;
+        return (n - start) * (settings_.no + 1) * settings_.ni;
     }
 
-    auto ni = this->ni_.value_or(this->robust_ ? 1 : 2);
-    auto no = this->no_.value_or(this->robust_ ? 15 : 0);
+    /// Returns the components of the points kept, which are empty until the
+    /// stream has two periods. The loops run are those of the last refit.
+    inline const StlResult<T>& result() const {
+        return result_;
+    }
 
-    auto nsjump = this->nsjump_.value_or((size_t) ceil(((float) newns) / 10.0));
-    auto ntjump = this->ntjump_.value_or((size_t) ceil(((float) nt) / 10.0));
-    auto nljump = this->nljump_.value_or((size_t) ceil(((float) nl) / 10.0));
+private:
+    void update() {
+        auto n = series_.size();
+        if (n < 2 * period_) {
+            return;
+        }
 
-    stl(y, n, newnp, newns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no, res.weights, res.seasonal, res.trend);
+        // points from first on are rewritten and the reach before them is
+        // refit for context
+        auto fitted = result_.trend.size();
+        auto first = fitted < reach_ ? 0 : fitted - reach_;
+        auto start = first < reach_ ? 0 : first - reach_;
+        // starting on the grids of the whole series interpolates the same
+        // points as a fit of every point would
+        auto shift = (offset_ + start) % align_;
+        start = shift <= start ? start - shift : 0;
+
+        auto& s = settings_;
+        auto robust = s.no > 0;
+        auto scale = robust && scale_.count() >= reach_ ? 6.0 * scale_.value() : 0.0;
+        auto& fit = workspace_.result_;
+        stl_options options;
+        options.scale = scale;
+        options.tolerance = params_.tolerance_.value_or(0.0);
+        // loess tests windows against the range of every point pushed
+        options.before = offset_ + start;
+        auto loops = stl<T, double>(series_.data() + start, n - start, s.np, s.ns, s.nt, s.nl, s.isdeg, s.itdeg, s.ildeg, s.nsjump, s.ntjump, s.nljump, s.ni, s.no, params_.threads_, fit.weights, fit.seasonal, fit.trend, workspace_.work1_, workspace_.work2_, workspace_.work3_, workspace_.work4_, workspace_.work5_, workspace_.work6_, workspace_.scratch_, workspace_.subseries_, options);
+        result_.inner_loops = loops.inner;
+        result_.outer_loops = loops.outer;
+
+        result_.seasonal.resize(n);
+        result_.trend.resize(n);
+        result_.remainder.resize(n);
+        result_.weights.resize(n);
+        for (auto i = first; i < n; i++) {
+            result_.seasonal[i] = fit.seasonal[i - start];
+            result_.trend[i] = fit.trend[i - start];
+            result_.remainder[i] = series_[i] - result_.seasonal[i] - result_.trend[i];
+            result_.weights[i] = fit.weights[i - start];
+        }
 
-    res.remainder.reserve(n);
-    for (size_t i = 0; i < n; i++) {
-        res.remainder.push_back(y[i] - res.seasonal[i] - res.trend[i]);
+        // points out of reach of the next update are final
+        auto done = n < reach_ ? 0 : n - reach_;
+        for (; final_ < done; final_++) {
+            if (robust && !std::isnan(result_.remainder[final_])) {
+                scale_.add(std::abs((double) result_.remainder[final_]));
+            }
+        }
     }
 
-    return res;
-}
-
-template<typename T>
-StlResult<T> StlParams::fit(const std::vector<T>& series, size_t period) const {
-    return StlParams::fit(series.data(), series.size(), period);
-}
+    void trim() {
+        if (history_ == 0 || series_.size() < 2 * history_) {
+            return;
+        }
+        // dropping points in bulk keeps the cost per point constant
+        auto drop = series_.size() - history_;
+        series_.erase(series_.begin(), series_.begin() + drop);
+        for (auto* component : {&result_.seasonal, &result_.trend, &result_.remainder, &result_.weights}) {
+            component->erase(component->begin(), component->begin() + std::min(drop, component->size()));
+        }
+        final_ -= std::min(drop, final_);
+        offset_ += drop;
+    }
 
-#if __cplusplus >= 202002L
-template<typename T>
-StlResult<T> StlParams::fit(std::span<const T> series, size_t period) const {
-    return StlParams::fit(series.data(), series.size(), period);
-}
-#endif
+    StlParams params_;
+    size_t period_;
+    stl_settings settings_;
+    size_t reach_;
+    size_t align_;
+    size_t history_;
+    std::vector<T> series_;
+    StlResult<T> result_;
+    StlWorkspace<T> workspace_;
+    p2_quantile scale_;
+    size_t final_ = 0;
+    size_t offset_ = 0;
+};
 
 /// A MSTL result.
 template<typename T = float>
@@ -597,9 +3492,15 @@ public:
 
     /// Returns the seasonal strength.
     inline std::vector<double> seasonal_strength() const {
+        // the moments of the remainder are shared by every component
+        moments r;
+        moments cr;
         std::vector<double> res;
+        res.reserve(seasonal.size());
         for (auto& s : seasonal) {
-            res.push_back(strength(s, remainder));
+            cr = moments();
+            component_moments(s.data(), remainder.data(), remainder.size(), res.empty() ? &r : nullptr, cr);
+            res.push_back(strength(r, cr));
         }
         return res;
     }
@@ -615,6 +3516,7 @@ class MstlParams {
     size_t iterate_ = 2;
     std::optional<float> lambda_ = std::nullopt;
     std::optional<std::vector<size_t>> swin_ = std::nullopt;
+    std::optional<std::pair<size_t, size_t>> warm_ = std::nullopt;
     StlParams stl_params_;
 
 public:
@@ -642,17 +3544,28 @@ public:
         return *this;
     }
 
-    /// Decomposes a time series from an array.
-    template<typename T>
+    /// Starts the STL fits of each iteration after the first from the trend
+    /// and robustness weights of the previous iteration, with the given
+    /// numbers of inner and outer loops. Without it, every iteration starts
+    /// from a zero trend, as in the reference MSTL, whose components warm
+    /// starts change by about a percent of the seasonal amplitude.
+    inline MstlParams warm_start(size_t inner_loops, size_t outer_loops) {
+        this->warm_ = std::make_pair(inner_loops, outer_loops);
+        return *this;
+    }
+
+    /// Decomposes a time series from an array. P is a precision policy for
+    /// the STL fits.
+    template<typename T, typename P = precision::mixed>
     MstlResult<T> fit(const T* series, size_t series_size, const size_t* periods, size_t periods_size) const;
 
     /// Decomposes a time series from a vector.
-    template<typename T>
+    template<typename T, typename P = precision::mixed>
     MstlResult<T> fit(const std::vector<T>& series, const std::vector<size_t>& periods) const;
 
 #if __cplusplus >= 202002L
     /// Decomposes a time series from a span.
-    template<typename T>
+    template<typename T, typename P = precision::mixed>
     MstlResult<T> fit(std::span<const T> series, std::span<const size_t> periods) const;
 #endif
 };
@@ -664,23 +3577,7 @@ inline MstlParams mstl_params() {
 
 namespace {
 
-template<typename T>
-std::vector<T> box_cox(const T* y, size_t y_size, float lambda) {
-    std::vector<T> res;
-    res.reserve(y_size);
-    if (lambda != 0.0) {
-        for (size_t i = 0; i < y_size; i++) {
-            res.push_back((T) (std::pow(y[i], lambda) - 1.0) / lambda);
-        }
-    } else {
-        for (size_t i = 0; i < y_size; i++) {
-            res.push_back(std::log(y[i]));
-        }
-    }
-    return res;
-}
-
-template<typename T>
+template<typename T, typename P>
 std::tuple<std::vector<T>, std::vector<T>, std::vector<std::vector<T>>> mstl(
     const T* x,
     size_t k,
@@ -689,6 +3586,7 @@ std::tuple<std::vector<T>, std::vector<T>, std::vector<std::vector<T>>> mstl(
     size_t iterate,
     std::optional<float> lambda,
     const std::optional<std::vector<size_t>>& swin,
+    const std::optional<std::pair<size_t, size_t>>& warm,
     const StlParams& stl_params
 ) {
     // keep track of indices instead of sorting seas_ids
@@ -705,63 +3603,80 @@ std::tuple<std::vector<T>, std::vector<T>, std::vector<std::vector<T>>> mstl(
         iterate = 1;
     }
 
-    std::vector<std::vector<T>> seasonality;
-    seasonality.reserve(seas_size);
-    std::vector<T> trend;
-
-    auto deseas = lambda.has_value() ? box_cox(x, k, lambda.value()) : std::vector<T>(x, x + k);
+    if (seas_size == 0) {
+        // TODO use Friedman's Super Smoother for trend
+        throw std::invalid_argument("periods must not be empty");
+    }
 
-    if (seas_size != 0) {
-        for (size_t i = 0; i < seas_size; i++) {
-            seasonality.push_back(std::vector<T>());
-        }
+    // settings of the fits of each seasonal component, in fit order
+    std::vector<stl_settings> settings;
+    settings.reserve(seas_size);
+    for (size_t i = 0; i < seas_size; i++) {
+        auto idx = indices[i];
+        auto ns = swin ? (*swin)[idx] : stl_params.ns_.value_or(7 + 4 * (i + 1));
+        settings.push_back(stl_params.settings(seas_ids[idx], ns));
+    }
 
-        for (size_t j = 0; j < iterate; j++) {
-            for (size_t i = 0; i < indices.size(); i++) {
-                auto idx = indices[i];
+    // fits write their components in place and share one workspace
+    StlWorkspace<T> workspace;
+    workspace.reserve(k, seas_ids[indices.back()]);
+    std::vector<std::vector<T>> seasonality(seas_size);
+    std::vector<T> trend;
+    std::vector<T> weights;
 
-                if (j > 0) {
-                    for (size_t ii = 0; ii < deseas.size(); ii++) {
-                        deseas[ii] += seasonality[idx][ii];
-                    }
-                }
+    // trend and weights of the last fit of each seasonal component
+    std::vector<std::vector<T>> warm_trends(warm ? seas_size : 0);
+    std::vector<std::vector<T>> warm_weights(warm ? seas_size : 0);
 
-                StlResult<T> fit;
-                if (swin) {
-                    StlParams clone = stl_params;
-                    fit = clone.seasonal_length((*swin)[idx]).fit(deseas, seas_ids[idx]);
-                } else if (stl_params.ns_.has_value()) {
-                    fit = stl_params.fit(deseas, seas_ids[idx]);
-                } else {
-                    StlParams clone = stl_params;
-                    fit = clone.seasonal_length(7 + 4 * (i + 1)).fit(deseas, seas_ids[idx]);
-                }
+    std::vector<T> deseas(x, x + k);
+    if (lambda.has_value()) {
+        box_cox_series(deseas.data(), k, lambda.value(), deseas.data());
+    }
 
-                seasonality[idx] = fit.seasonal;
-                trend = fit.trend;
+    for (size_t j = 0; j < iterate; j++) {
+        for (size_t i = 0; i < indices.size(); i++) {
+            auto idx = indices[i];
+            auto& seasonal = seasonality[idx];
 
+            if (j > 0) {
                 for (size_t ii = 0; ii < deseas.size(); ii++) {
-                    deseas[ii] -= seasonality[idx][ii];
+                    deseas[ii] += seasonal[ii];
                 }
             }
+
+            auto s = settings[i];
+            // weights are only kept to start the next iteration from
+            stl_options options;
+            options.weights = false;
+            if (warm && j > 0) {
+                s.ni = warm->first;
+                s.no = warm->second;
+                options.warm_trend = true;
+                options.warm_weights = settings[i].no > 0;
+            }
+            stl_params.fit_components<T, P>(deseas.data(), k, s, seasonal, warm ? warm_trends[idx] : trend, warm ? warm_weights[idx] : weights, options, workspace);
+
+            for (size_t ii = 0; ii < deseas.size(); ii++) {
+                deseas[ii] -= seasonal[ii];
+            }
         }
-    } else {
-        // TODO use Friedman's Super Smoother for trend
-        throw std::invalid_argument("periods must not be empty");
     }
 
-    std::vector<T> remainder;
-    remainder.reserve(k);
+    if (warm) {
+        trend = std::move(warm_trends[indices.back()]);
+    }
+
+    // the remainder replaces the deseasonalized series
     for (size_t i = 0; i < k; i++) {
-        remainder.push_back(deseas[i] - trend[i]);
+        deseas[i] -= trend[i];
     }
 
-    return std::make_tuple(trend, remainder, seasonality);
+    return std::make_tuple(std::move(trend), std::move(deseas), std::move(seasonality));
 }
 
 }
 
-template<typename T>
+template<typename T, typename P>
 MstlResult<T> MstlParams::fit(const T* series, size_t series_size, const size_t* periods, size_t periods_size) const {
     // return error to be consistent with stl
     // and ensure seasonal is always same length as periods
@@ -793,7 +3708,7 @@ MstlResult<T> MstlParams::fit(const T* series, size_t series_size, const size_t*
         }
     }
 
-    auto [trend, remainder, seasonal] = mstl(
+    auto [trend, remainder, seasonal] = mstl<T, P>(
         series,
         series_size,
         periods,
@@ -801,25 +3716,26 @@ MstlResult<T> MstlParams::fit(const T* series, size_t series_size, const size_t*
         iterate_,
         lambda_,
         swin_,
+        warm_,
         stl_params_
     );
 
     return MstlResult<T> {
-        seasonal,
-        trend,
-        remainder
+        std::move(seasonal),
+        std::move(trend),
+        std::move(remainder)
     };
 }
 
-template<typename T>
+template<typename T, typename P>
 MstlResult<T> MstlParams::fit(const std::vector<T>& series, const std::vector<size_t>& periods) const {
-    return MstlParams::fit(series.data(), series.size(), periods.data(), periods.size());
+    return MstlParams::fit<T, P>(series.data(), series.size(), periods.data(), periods.size());
 }
 
 #if __cplusplus >= 202002L
-template<typename T>
+template<typename T, typename P>
 MstlResult<T> MstlParams::fit(std::span<const T> series, std::span<const size_t> periods) const {
-    return MstlParams::fit(series.data(), series.size(), periods.data(), periods.size());
+    return MstlParams::fit<T, P>(series.data(), series.size(), periods.data(), periods.size());
 }
 #endif
 
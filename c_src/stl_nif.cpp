@@ -1,4 +1,12 @@
 #include <fine.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
 #include "stl.hpp"
 
 // Add encoders and decoders for float type
@@ -44,11 +52,27 @@ namespace atoms {
   auto inner_loops = fine::Atom("inner_loops");
   auto outer_loops = fine::Atom("outer_loops");
   auto robust = fine::Atom("robust");
+  auto initial_trend = fine::Atom("initial_trend");
+  auto initial_weights = fine::Atom("initial_weights");
+  auto tolerance = fine::Atom("tolerance");
 
   // MSTL specific params
   auto iterations = fine::Atom("iterations");
   auto lambda = fine::Atom("lambda");
   auto seasonal_lengths = fine::Atom("seasonal_lengths");
+  auto warm_start = fine::Atom("warm_start");
+  auto outputs = fine::Atom("outputs");
+
+  auto ok = fine::Atom("ok");
+  auto f32 = fine::Atom("f32");
+  auto f64 = fine::Atom("f64");
+
+  // Result components
+  auto seasonal = fine::Atom("seasonal");
+  auto trend = fine::Atom("trend");
+  auto remainder = fine::Atom("remainder");
+  auto weights = fine::Atom("weights");
+  auto strengths = fine::Atom("strengths");
 }
 
 // Elixir struct representation for StlParams
@@ -65,11 +89,16 @@ struct ExStlParams {
   std::optional<int64_t> inner_loops;
   std::optional<int64_t> outer_loops;
   std::optional<bool> robust;
+  std::optional<std::vector<double>> initial_trend;
+  std::optional<std::vector<double>> initial_weights;
+  std::optional<double> tolerance;
+  std::optional<std::vector<fine::Atom>> outputs;
 
   // MSTL specific fields
   std::optional<int64_t> iterations;
   std::optional<double> lambda;
   std::optional<std::vector<int64_t>> seasonal_lengths;
+  std::optional<std::tuple<int64_t, int64_t>> warm_start;
 
   static constexpr auto module = &atoms::ElixirStlParams;
 
@@ -87,43 +116,131 @@ struct ExStlParams {
       std::make_tuple(&ExStlParams::inner_loops, &atoms::inner_loops),
       std::make_tuple(&ExStlParams::outer_loops, &atoms::outer_loops),
       std::make_tuple(&ExStlParams::robust, &atoms::robust),
+      std::make_tuple(&ExStlParams::initial_trend, &atoms::initial_trend),
+      std::make_tuple(&ExStlParams::initial_weights, &atoms::initial_weights),
+      std::make_tuple(&ExStlParams::tolerance, &atoms::tolerance),
+      std::make_tuple(&ExStlParams::outputs, &atoms::outputs),
       std::make_tuple(&ExStlParams::iterations, &atoms::iterations),
       std::make_tuple(&ExStlParams::lambda, &atoms::lambda),
-      std::make_tuple(&ExStlParams::seasonal_lengths, &atoms::seasonal_lengths)
+      std::make_tuple(&ExStlParams::seasonal_lengths, &atoms::seasonal_lengths),
+      std::make_tuple(&ExStlParams::warm_start, &atoms::warm_start)
     );
   }
 };
 
-// Helper function to convert vectors to Elixir lists
-std::vector<float> to_vector_float(ErlNifEnv* env, const ERL_NIF_TERM& term) {
+// Helper function to convert Elixir lists to vectors, with nil as NaN for
+// missing values. Integers are converted straight to T, so that 64-bit
+// counters are rounded only once.
+template<typename T = float>
+std::vector<T> to_vector_float(ErlNifEnv* env, const ERL_NIF_TERM& term) {
   unsigned length;
   if (!enif_get_list_length(env, term, &length)) {
     throw std::invalid_argument("Expected a list");
   }
 
-  std::vector<float> result;
+  std::vector<T> result;
   result.reserve(length);
 
   ERL_NIF_TERM head, tail;
   ERL_NIF_TERM list = term;
+  auto nil = enif_make_atom(env, "nil");
 
   while (enif_get_list_cell(env, list, &head, &tail)) {
     double value;
-    if (!enif_get_double(env, head, &value)) {
-      int int_value;
-      if (enif_get_int(env, head, &int_value)) {
-        value = static_cast<double>(int_value);
-      } else {
-        throw std::invalid_argument("List elements must be numbers");
-      }
+    ErlNifSInt64 int_value;
+    if (enif_get_double(env, head, &value)) {
+      result.push_back(static_cast<T>(value));
+    } else if (enif_get_int64(env, head, &int_value)) {
+      result.push_back(static_cast<T>(int_value));
+    } else if (enif_is_identical(head, nil)) {
+      result.push_back(std::numeric_limits<T>::quiet_NaN());
+    } else {
+      throw std::invalid_argument("List elements must be numbers");
     }
-    result.push_back(static_cast<float>(value));
     list = tail;
   }
 
   return result;
 }
 
+// Helper function to convert vectors to Elixir lists, with NaN as nil
+template<typename T>
+fine::Term to_list_float(ErlNifEnv* env, const std::vector<T>& values) {
+  std::vector<ERL_NIF_TERM> terms;
+  terms.reserve(values.size());
+
+  auto nil = enif_make_atom(env, "nil");
+  for (auto value : values) {
+    terms.push_back(std::isnan(value) ? nil : enif_make_double(env, value));
+  }
+
+  return enif_make_list_from_array(env, terms.data(), static_cast<unsigned>(terms.size()));
+}
+
+// Helper function to read a binary of native floats without copying, unless
+// its data is not aligned for T
+template<typename T>
+std::pair<const T*, size_t> inspect_values(ErlNifEnv* env, const ERL_NIF_TERM& term, std::vector<T>& copy) {
+  ErlNifBinary binary;
+  if (!enif_inspect_binary(env, term, &binary)) {
+    throw std::invalid_argument("Expected a binary");
+  }
+
+  if (binary.size % sizeof(T) != 0) {
+    throw std::invalid_argument("binary size must be a multiple of " + std::to_string(sizeof(T)));
+  }
+
+  auto size = binary.size / sizeof(T);
+  if (reinterpret_cast<uintptr_t>(binary.data) % alignof(T) != 0) {
+    copy.resize(size);
+    std::memcpy(copy.data(), binary.data, binary.size);
+    return {copy.data(), size};
+  }
+  return {reinterpret_cast<const T*>(binary.data), size};
+}
+
+// Helper function to convert vectors to binaries of native floats
+template<typename T>
+fine::Term to_binary(ErlNifEnv* env, const std::vector<T>& values) {
+  ERL_NIF_TERM term;
+  auto data = enif_make_new_binary(env, values.size() * sizeof(T), &term);
+  if (!values.empty()) {
+    std::memcpy(data, values.data(), values.size() * sizeof(T));
+  }
+  return term;
+}
+
+// Convert a list of output atoms to a mask of stl::output flags
+unsigned convert_outputs(const std::vector<fine::Atom>& names) {
+  unsigned outputs = 0;
+  for (const auto& name : names) {
+    if (name == atoms::seasonal) {
+      outputs |= stl::output::seasonal;
+    } else if (name == atoms::trend) {
+      outputs |= stl::output::trend;
+    } else if (name == atoms::remainder) {
+      outputs |= stl::output::remainder;
+    } else if (name == atoms::weights) {
+      outputs |= stl::output::weights;
+    } else if (name == atoms::strengths) {
+      outputs |= stl::output::strengths;
+    } else {
+      throw std::invalid_argument("outputs must be :seasonal, :trend, :remainder, :weights or :strengths");
+    }
+  }
+  return outputs;
+}
+
+// Helper function to encode the seasonal and trend strengths of a result,
+// or nil when they were not computed
+template<typename T>
+fine::Term encode_strengths(ErlNifEnv* env, const stl::StlResult<T>& result) {
+  if (!result.seasonal_strength_) {
+    return enif_make_atom(env, "nil");
+  }
+  return fine::encode(env, std::make_tuple(result.seasonal_strength(), result.trend_strength()));
+}
+
 // Convert ExStlParams to stl::StlParams
 stl::StlParams convert_params(const ExStlParams& ex_params) {
   stl::StlParams params;
@@ -146,21 +263,29 @@ stl::StlParams convert_params(const ExStlParams& ex_params) {
   APPLY_PARAM(inner_loops)
   APPLY_PARAM(outer_loops)
   APPLY_PARAM(robust)
+  APPLY_PARAM(initial_trend)
+  APPLY_PARAM(initial_weights)
+  APPLY_PARAM(tolerance)
+  APPLY_PARAM(lambda)
 
   #undef APPLY_PARAM
 
+  if (ex_params.outputs) {
+    params = params.outputs(convert_outputs(*ex_params.outputs));
+  }
+
   return params;
 }
 
-// NIF to decompose with struct params
-std::tuple<std::vector<float>, std::vector<float>, std::vector<float>, std::vector<float>> decompose(
+template<typename T>
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term, uint64_t, uint64_t, fine::Term> decompose_list(
   ErlNifEnv* env,
   fine::Term series_term,
   int64_t period,
-  ExStlParams ex_params,
+  const ExStlParams& ex_params,
   bool include_weights
 ) {
-  auto series = to_vector_float(env, series_term);
+  auto series = to_vector_float<T>(env, series_term);
 
   if (period < 2) {
     throw std::invalid_argument("period must be greater than 1");
@@ -169,30 +294,56 @@ std::tuple<std::vector<float>, std::vector<float>, std::vector<float>, std::vect
   auto params = convert_params(ex_params);
   auto result = params.fit(series, period);
 
-  if (include_weights) {
-    return std::make_tuple(result.seasonal, result.trend, result.remainder, result.weights);
-  } else {
+  return std::make_tuple(
+    fine::encode(env, result.seasonal),
+    fine::encode(env, result.trend),
+    to_list_float(env, result.remainder),
     // Return empty weights vector if not requested
-    return std::make_tuple(result.seasonal, result.trend, result.remainder, std::vector<float>());
+    fine::encode(env, include_weights ? result.weights : std::vector<T>()),
+    result.inner_loops,
+    result.outer_loops,
+    encode_strengths(env, result)
+  );
+}
+
+// NIF to decompose with struct params in the precision of type, also
+// returning the loops run and the strengths
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term, uint64_t, uint64_t, fine::Term> decompose(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params,
+  bool include_weights,
+  fine::Atom type
+) {
+  if (type == atoms::f32) {
+    return decompose_list<float>(env, series_term, period, ex_params, include_weights);
+  } else if (type == atoms::f64) {
+    return decompose_list<double>(env, series_term, period, ex_params, include_weights);
   }
+  throw std::invalid_argument("type must be :f32 or :f64");
 }
 FINE_NIF(decompose, 0);
 
-// NIF to decompose with multiple seasonal patterns
-std::tuple<std::vector<std::vector<float>>, std::vector<float>, std::vector<float>, std::vector<float>> decompose_multi(
+// Dirty CPU variant for series too long to decompose on a normal scheduler
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term, uint64_t, uint64_t, fine::Term> decompose_dirty(
   ErlNifEnv* env,
   fine::Term series_term,
-  std::vector<int64_t> periods_int64,
-  ExStlParams ex_params
+  int64_t period,
+  ExStlParams ex_params,
+  bool include_weights,
+  fine::Atom type
 ) {
-  (void)env;
-  auto series = to_vector_float(env, series_term);
+  return decompose(env, series_term, period, ex_params, include_weights, type);
+}
+FINE_NIF(decompose_dirty, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
+// Convert int64_t periods to size_t
+std::vector<size_t> convert_periods(const std::vector<int64_t>& periods_int64, size_t series_size) {
   if (periods_int64.empty()) {
     throw std::invalid_argument("periods must not be empty");
   }
 
-  // Convert int64_t periods to size_t
   std::vector<size_t> periods;
   periods.reserve(periods_int64.size());
   for (auto period : periods_int64) {
@@ -200,13 +351,18 @@ std::tuple<std::vector<std::vector<float>>, std::vector<float>, std::vector<floa
       throw std::invalid_argument("periods must be at least 2");
     }
 
-    if (static_cast<size_t>(series.size()) < static_cast<size_t>(period * 2)) {
+    if (series_size < static_cast<size_t>(period * 2)) {
       throw std::invalid_argument("series has less than two periods");
     }
 
     periods.push_back(static_cast<size_t>(period));
   }
 
+  return periods;
+}
+
+// Convert ExStlParams to stl::MstlParams
+stl::MstlParams convert_mstl_params(const ExStlParams& ex_params) {
   // Create MSTL params and apply STL params
   auto stl_cpp_params = convert_params(ex_params);
   auto mstl_params = stl::mstl_params().stl_params(stl_cpp_params);
@@ -233,25 +389,623 @@ std::tuple<std::vector<std::vector<float>>, std::vector<float>, std::vector<floa
     mstl_params = mstl_params.seasonal_lengths(seasonal_lengths);
   }
 
+  // Apply warm_start if provided
+  if (ex_params.warm_start) {
+    auto [inner_loops, outer_loops] = *ex_params.warm_start;
+    if (inner_loops < 0 || outer_loops < 0) {
+      throw std::invalid_argument("warm_start loops must not be negative");
+    }
+    mstl_params = mstl_params.warm_start(static_cast<size_t>(inner_loops), static_cast<size_t>(outer_loops));
+  }
+
+  return mstl_params;
+}
+
+template<typename T>
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term> decompose_multi_list(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  const std::vector<int64_t>& periods_int64,
+  const ExStlParams& ex_params
+) {
+  auto series = to_vector_float<T>(env, series_term);
+  auto periods = convert_periods(periods_int64, series.size());
+  auto mstl_params = convert_mstl_params(ex_params);
+
   // Call fit with periods
   auto result = mstl_params.fit(series, periods);
 
   // Return components (empty weights vector since MSTL doesn't provide weights)
-  return std::make_tuple(result.seasonal, result.trend, result.remainder, std::vector<float>());
+  return std::make_tuple(fine::encode(env, result.seasonal), fine::encode(env, result.trend), to_list_float(env, result.remainder), fine::encode(env, std::vector<T>()));
+}
+
+// NIF to decompose with multiple seasonal patterns in the precision of type
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term> decompose_multi(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  std::vector<int64_t> periods_int64,
+  ExStlParams ex_params,
+  fine::Atom type
+) {
+  if (type == atoms::f32) {
+    return decompose_multi_list<float>(env, series_term, periods_int64, ex_params);
+  } else if (type == atoms::f64) {
+    return decompose_multi_list<double>(env, series_term, periods_int64, ex_params);
+  }
+  throw std::invalid_argument("type must be :f32 or :f64");
 }
 FINE_NIF(decompose_multi, 0);
 
-// Helper functions for calculating strength
-double seasonal_strength(ErlNifEnv* env, std::vector<float> seasonal, std::vector<float> remainder) {
+// Dirty CPU variant of decompose_multi
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term> decompose_multi_dirty(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  std::vector<int64_t> periods_int64,
+  ExStlParams ex_params,
+  fine::Atom type
+) {
+  return decompose_multi(env, series_term, periods_int64, ex_params, type);
+}
+FINE_NIF(decompose_multi_dirty, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+template<typename T>
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term, uint64_t, uint64_t, fine::Term> decompose_values(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  const ExStlParams& ex_params,
+  bool include_weights
+) {
+  std::vector<T> copy;
+  auto [series, series_size] = inspect_values<T>(env, series_term, copy);
+
+  if (period < 2) {
+    throw std::invalid_argument("period must be greater than 1");
+  }
+
+  auto params = convert_params(ex_params);
+  auto result = params.fit(series, series_size, static_cast<size_t>(period));
+
+  return std::make_tuple(
+    to_binary(env, result.seasonal),
+    to_binary(env, result.trend),
+    to_binary(env, result.remainder),
+    to_binary(env, include_weights ? result.weights : std::vector<T>()),
+    result.inner_loops,
+    result.outer_loops,
+    encode_strengths(env, result)
+  );
+}
+
+// NIF to decompose a binary of native floats, returning binaries of the
+// same type
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term, uint64_t, uint64_t, fine::Term> decompose_binary(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params,
+  bool include_weights,
+  fine::Atom type
+) {
+  if (type == atoms::f32) {
+    return decompose_values<float>(env, series_term, period, ex_params, include_weights);
+  } else if (type == atoms::f64) {
+    return decompose_values<double>(env, series_term, period, ex_params, include_weights);
+  }
+  throw std::invalid_argument("type must be :f32 or :f64");
+}
+FINE_NIF(decompose_binary, 0);
+
+// Dirty CPU variant of decompose_binary
+std::tuple<fine::Term, fine::Term, fine::Term, fine::Term, uint64_t, uint64_t, fine::Term> decompose_binary_dirty(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params,
+  bool include_weights,
+  fine::Atom type
+) {
+  return decompose_binary(env, series_term, period, ex_params, include_weights, type);
+}
+FINE_NIF(decompose_binary_dirty, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+template<typename T>
+std::tuple<std::vector<fine::Term>, fine::Term, fine::Term> decompose_multi_values(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  const std::vector<int64_t>& periods_int64,
+  const ExStlParams& ex_params
+) {
+  std::vector<T> copy;
+  auto [series, series_size] = inspect_values<T>(env, series_term, copy);
+  auto periods = convert_periods(periods_int64, series_size);
+  auto mstl_params = convert_mstl_params(ex_params);
+
+  auto result = mstl_params.fit(series, series_size, periods.data(), periods.size());
+
+  std::vector<fine::Term> seasonal;
+  seasonal.reserve(result.seasonal.size());
+  for (const auto& component : result.seasonal) {
+    seasonal.push_back(to_binary(env, component));
+  }
+  return std::make_tuple(seasonal, to_binary(env, result.trend), to_binary(env, result.remainder));
+}
+
+// NIF to decompose a binary of native floats with multiple seasonal
+// patterns, returning binaries of the same type
+std::tuple<std::vector<fine::Term>, fine::Term, fine::Term> decompose_multi_binary(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  std::vector<int64_t> periods_int64,
+  ExStlParams ex_params,
+  fine::Atom type
+) {
+  if (type == atoms::f32) {
+    return decompose_multi_values<float>(env, series_term, periods_int64, ex_params);
+  } else if (type == atoms::f64) {
+    return decompose_multi_values<double>(env, series_term, periods_int64, ex_params);
+  }
+  throw std::invalid_argument("type must be :f32 or :f64");
+}
+FINE_NIF(decompose_multi_binary, 0);
+
+// Dirty CPU variant of decompose_multi_binary
+std::tuple<std::vector<fine::Term>, fine::Term, fine::Term> decompose_multi_binary_dirty(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  std::vector<int64_t> periods_int64,
+  ExStlParams ex_params,
+  fine::Atom type
+) {
+  return decompose_multi_binary(env, series_term, periods_int64, ex_params, type);
+}
+FINE_NIF(decompose_multi_binary_dirty, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+// Resource holding a decomposition that runs in slices between yields
+template<typename T>
+struct FitResource {
+  stl::StlFit<T> fit;
+  bool include_weights;
+  bool binary;
+
+  FitResource(const stl::StlParams& params, const T* series, size_t series_size, size_t period, bool include_weights, bool binary) :
+    fit(params, series, series_size, period), include_weights(include_weights), binary(binary) {}
+};
+FINE_RESOURCE(FitResource<float>);
+FINE_RESOURCE(FitResource<double>);
+
+// Encodes a finished decomposition like decompose or decompose_binary
+template<typename T>
+ERL_NIF_TERM encode_fit(ErlNifEnv* env, const FitResource<T>& resource) {
+  auto& result = resource.fit.result();
+  auto weights = resource.include_weights ? result.weights : std::vector<T>();
+
+  if (resource.binary) {
+    return fine::encode(env, std::make_tuple(
+      to_binary(env, result.seasonal),
+      to_binary(env, result.trend),
+      to_binary(env, result.remainder),
+      to_binary(env, weights),
+      result.inner_loops,
+      result.outer_loops,
+      encode_strengths(env, result)
+    ));
+  }
+  return fine::encode(env, std::make_tuple(result.seasonal, result.trend, to_list_float(env, result.remainder), weights, result.inner_loops, result.outer_loops, encode_strengths(env, result)));
+}
+
+template<typename T>
+ERL_NIF_TERM decompose_slice(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]);
+
+// Runs steps of a decomposition until it is done or the timeslice of the
+// process is used up, in which case it reschedules itself to resume later
+template<typename T>
+fine::Term decompose_steps(ErlNifEnv* env, fine::ResourcePtr<FitResource<T>> resource) {
+  // report time to the scheduler in whole percents of a 1 ms timeslice
+  auto reported = std::chrono::steady_clock::now();
+  while (!resource->fit.step()) {
+    auto now = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - reported).count();
+    if (us >= 10) {
+      reported = now;
+      if (enif_consume_timeslice(env, static_cast<int>(std::min<int64_t>(us / 10, 100)))) {
+        ERL_NIF_TERM args[] = {fine::encode(env, resource)};
+        return enif_schedule_nif(env, "decompose_slice", 0, decompose_slice<T>, 1, args);
+      }
+    }
+  }
+
+  return encode_fit(env, *resource);
+}
+
+template<typename T>
+ERL_NIF_TERM decompose_slice(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  return fine::nif(env, argc, argv, decompose_steps<T>);
+}
+
+template<typename T>
+fine::Term decompose_yielding_list(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  const ExStlParams& ex_params,
+  bool include_weights
+) {
+  auto series = to_vector_float<T>(env, series_term);
+
+  if (period < 2) {
+    throw std::invalid_argument("period must be greater than 1");
+  }
+
+  auto params = convert_params(ex_params);
+  auto resource = fine::make_resource<FitResource<T>>(params, series.data(), series.size(), static_cast<size_t>(period), include_weights, false);
+
+  ERL_NIF_TERM args[] = {fine::encode(env, resource)};
+  return enif_schedule_nif(env, "decompose_slice", 0, decompose_slice<T>, 1, args);
+}
+
+// NIF to decompose on a normal scheduler, yielding between slices
+fine::Term decompose_yielding(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params,
+  bool include_weights,
+  fine::Atom type
+) {
+  if (type == atoms::f32) {
+    return decompose_yielding_list<float>(env, series_term, period, ex_params, include_weights);
+  } else if (type == atoms::f64) {
+    return decompose_yielding_list<double>(env, series_term, period, ex_params, include_weights);
+  }
+  throw std::invalid_argument("type must be :f32 or :f64");
+}
+FINE_NIF(decompose_yielding, 0);
+
+template<typename T>
+fine::Term decompose_binary_yielding_values(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  const ExStlParams& ex_params,
+  bool include_weights
+) {
+  std::vector<T> copy;
+  auto [series, series_size] = inspect_values<T>(env, series_term, copy);
+
+  if (period < 2) {
+    throw std::invalid_argument("period must be greater than 1");
+  }
+
+  auto params = convert_params(ex_params);
+  auto resource = fine::make_resource<FitResource<T>>(params, series, series_size, static_cast<size_t>(period), include_weights, true);
+
+  ERL_NIF_TERM args[] = {fine::encode(env, resource)};
+  return enif_schedule_nif(env, "decompose_slice", 0, decompose_slice<T>, 1, args);
+}
+
+// NIF to decompose a binary on a normal scheduler, yielding between slices
+fine::Term decompose_binary_yielding(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params,
+  bool include_weights,
+  fine::Atom type
+) {
+  if (type == atoms::f32) {
+    return decompose_binary_yielding_values<float>(env, series_term, period, ex_params, include_weights);
+  } else if (type == atoms::f64) {
+    return decompose_binary_yielding_values<double>(env, series_term, period, ex_params, include_weights);
+  }
+  throw std::invalid_argument("type must be :f32 or :f64");
+}
+FINE_NIF(decompose_binary_yielding, 0);
+
+// Resource holding a decomposition stream, which processes may share
+struct StreamResource {
+  std::mutex mutex;
+  stl::StlStream<float> stream;
+
+  StreamResource(const stl::StlParams& params, size_t period, size_t history) : stream(params, period, history) {}
+};
+FINE_RESOURCE(StreamResource);
+
+// NIF to create a decomposition stream
+fine::ResourcePtr<StreamResource> stream_new(
+  ErlNifEnv* env,
+  int64_t period,
+  ExStlParams ex_params,
+  int64_t history
+) {
   (void)env;
-  return stl::StlResult<float>{seasonal, {}, remainder, {}}.seasonal_strength();
+  if (period < 2) {
+    throw std::invalid_argument("period must be greater than 1");
+  }
+
+  if (history < 0) {
+    throw std::invalid_argument("history must not be negative");
+  }
+
+  auto params = convert_params(ex_params);
+  return fine::make_resource<StreamResource>(params, static_cast<size_t>(period), static_cast<size_t>(history));
 }
-FINE_NIF(seasonal_strength, 0);
+FINE_NIF(stream_new, 0);
+
+// Appends values to a stream, waiting for any call in progress, on a dirty
+// CPU scheduler
+fine::Atom stream_push_dirty(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource, fine::Term values_term) {
+  auto values = to_vector_float(env, values_term);
+
+  std::lock_guard<std::mutex> lock(resource->mutex);
+  resource->stream.push_many(values);
+  return atoms::ok;
+}
+FINE_NIF(stream_push_dirty, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ERL_NIF_TERM stream_push_waiting(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  return fine::nif(env, argc, argv, stream_push_dirty);
+}
+
+// NIF to append values to a stream. A stream busy with another call sends
+// the push to a dirty scheduler rather than block a normal one on the lock
+fine::Term stream_push(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource, fine::Term values_term) {
+  auto values = to_vector_float(env, values_term);
+
+  std::unique_lock<std::mutex> lock(resource->mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    ERL_NIF_TERM args[] = {fine::encode(env, resource), values_term};
+    return enif_schedule_nif(env, "stream_push_dirty", ERL_NIF_DIRTY_JOB_CPU_BOUND, stream_push_waiting, 2, args);
+  }
+  resource->stream.push_many(values);
+  return fine::encode(env, atoms::ok);
+}
+FINE_NIF(stream_push, 0);
+
+// NIF to estimate the cost of appending values to a stream
+int64_t stream_cost(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource, int64_t count) {
+  (void)env;
+  if (count < 0) {
+    throw std::invalid_argument("count must not be negative");
+  }
+  // a stream busy with another call sends this push straight to a dirty
+  // scheduler
+  std::unique_lock<std::mutex> lock(resource->mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return static_cast<int64_t>(resource->stream.cost(static_cast<size_t>(count)));
+}
+FINE_NIF(stream_cost, 0);
+
+// Components of a stream in the form of decompose
+typedef std::tuple<std::vector<float>, std::vector<float>, fine::Term, std::vector<float>> StreamComponents;
+
+StreamComponents stream_components(ErlNifEnv* env, const stl::StlStream<float>& stream, bool include_weights) {
+  auto& result = stream.result();
+
+  if (include_weights) {
+    return std::make_tuple(result.seasonal, result.trend, to_list_float(env, result.remainder), result.weights);
+  } else {
+    return std::make_tuple(result.seasonal, result.trend, to_list_float(env, result.remainder), std::vector<float>());
+  }
+}
+
+// Reads the components of a stream, waiting for any call in progress
+StreamComponents stream_result_dirty(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource, bool include_weights) {
+  std::lock_guard<std::mutex> lock(resource->mutex);
+  return stream_components(env, resource->stream, include_weights);
+}
+
+ERL_NIF_TERM stream_result_waiting(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  return fine::nif(env, argc, argv, stream_result_dirty);
+}
+
+// NIF to read the components of a stream, which waits for a busy stream on
+// a dirty scheduler
+fine::Term stream_result(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource, bool include_weights) {
+  std::unique_lock<std::mutex> lock(resource->mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    ERL_NIF_TERM args[] = {fine::encode(env, resource), fine::encode(env, include_weights)};
+    return enif_schedule_nif(env, "stream_result_dirty", ERL_NIF_DIRTY_JOB_CPU_BOUND, stream_result_waiting, 2, args);
+  }
+  return fine::encode(env, stream_components(env, resource->stream, include_weights));
+}
+FINE_NIF(stream_result, 0);
+
+// Counts the points kept by a stream, waiting for any call in progress
+int64_t stream_size_dirty(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource) {
+  (void)env;
+  std::lock_guard<std::mutex> lock(resource->mutex);
+  return static_cast<int64_t>(resource->stream.size());
+}
+
+ERL_NIF_TERM stream_size_waiting(ErlNifEnv* env, int argc, const ERL_NIF_TERM argv[]) {
+  return fine::nif(env, argc, argv, stream_size_dirty);
+}
+
+// NIF to count the points kept by a stream, which waits for a busy stream
+// on a dirty scheduler
+fine::Term stream_size(ErlNifEnv* env, fine::ResourcePtr<StreamResource> resource) {
+  std::unique_lock<std::mutex> lock(resource->mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    ERL_NIF_TERM args[] = {fine::encode(env, resource)};
+    return enif_schedule_nif(env, "stream_size_dirty", ERL_NIF_DIRTY_JOB_CPU_BOUND, stream_size_waiting, 1, args);
+  }
+  return fine::encode(env, static_cast<int64_t>(resource->stream.size()));
+}
+FINE_NIF(stream_size, 0);
+
+// Resource holding a decomposition result, whose components are only
+// converted to terms when asked for
+struct ResultResource {
+  stl::StlResult<float> result;
+
+  explicit ResultResource(stl::StlResult<float> result) : result(std::move(result)) {}
+
+  const std::vector<float>& component(const fine::Atom& name) const {
+    if (name == atoms::seasonal) {
+      return result.seasonal;
+    } else if (name == atoms::trend) {
+      return result.trend;
+    } else if (name == atoms::remainder) {
+      return result.remainder;
+    } else if (name == atoms::weights) {
+      return result.weights;
+    }
+    throw std::invalid_argument("component must be :seasonal, :trend, :remainder or :weights");
+  }
+};
+FINE_RESOURCE(ResultResource);
+
+// NIF to decompose into a result resource
+fine::ResourcePtr<ResultResource> decompose_native(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params
+) {
+  auto series = to_vector_float(env, series_term);
+
+  if (period < 2) {
+    throw std::invalid_argument("period must be greater than 1");
+  }
+
+  auto params = convert_params(ex_params);
+  return fine::make_resource<ResultResource>(params.fit(series, static_cast<size_t>(period)));
+}
+FINE_NIF(decompose_native, 0);
+
+// Dirty CPU variant of decompose_native
+fine::ResourcePtr<ResultResource> decompose_native_dirty(
+  ErlNifEnv* env,
+  fine::Term series_term,
+  int64_t period,
+  ExStlParams ex_params
+) {
+  return decompose_native(env, series_term, period, ex_params);
+}
+FINE_NIF(decompose_native_dirty, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-double trend_strength(ErlNifEnv* env, std::vector<float> trend, std::vector<float> remainder) {
+// NIF to read a slice of a component as a list, with nil for missing values
+fine::Term result_slice(
+  ErlNifEnv* env,
+  fine::ResourcePtr<ResultResource> resource,
+  fine::Atom name,
+  int64_t start,
+  int64_t length
+) {
+  auto& values = resource->component(name);
+  auto size = static_cast<int64_t>(values.size());
+  start = std::clamp<int64_t>(start, 0, size);
+  length = std::clamp<int64_t>(length, 0, size - start);
+
+  return to_list_float(env, std::vector<float>(values.begin() + start, values.begin() + start + length));
+}
+FINE_NIF(result_slice, 0);
+
+// NIF to read a component as a binary of native 32-bit floats, which
+// shares the memory of the resource instead of copying it
+fine::Term result_binary(ErlNifEnv* env, fine::ResourcePtr<ResultResource> resource, fine::Atom name) {
+  auto& values = resource->component(name);
+  return fine::make_resource_binary(env, resource, reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+}
+FINE_NIF(result_binary, 0);
+
+// NIF for the strength of the seasonal or trend component
+double result_strength(ErlNifEnv* env, fine::ResourcePtr<ResultResource> resource, fine::Atom name) {
+  (void)env;
+  if (name == atoms::seasonal) {
+    return resource->result.seasonal_strength();
+  } else if (name == atoms::trend) {
+    return resource->result.trend_strength();
+  }
+  throw std::invalid_argument("strength component must be :seasonal or :trend");
+}
+FINE_NIF(result_strength, 0);
+
+// NIF for the mean, variance, minimum and maximum of a component, leaving
+// out missing values
+std::tuple<double, double, double, double> result_stats(ErlNifEnv* env, fine::ResourcePtr<ResultResource> resource, fine::Atom name) {
+  (void)env;
+  auto& values = resource->component(name);
+
+  size_t count = 0;
+  double mean = 0.0;
+  double m2 = 0.0;
+  double min = std::numeric_limits<double>::infinity();
+  double max = -std::numeric_limits<double>::infinity();
+  for (auto value : values) {
+    if (std::isnan(value)) {
+      continue;
+    }
+    count++;
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+    min = std::min(min, static_cast<double>(value));
+    max = std::max(max, static_cast<double>(value));
+  }
+
+  if (count == 0) {
+    throw std::invalid_argument("component has no values");
+  }
+  return std::make_tuple(mean, count > 1 ? m2 / (count - 1) : 0.0, min, max);
+}
+FINE_NIF(result_stats, 0);
+
+// NIF for the indices of points whose remainder is more than threshold
+// robust standard deviations (1.4826 times the median absolute remainder)
+// from zero
+std::vector<int64_t> result_anomalies(ErlNifEnv* env, fine::ResourcePtr<ResultResource> resource, double threshold) {
   (void)env;
-  return stl::StlResult<float>{{}, trend, remainder, {}}.trend_strength();
+  auto& remainder = resource->result.remainder;
+
+  std::vector<float> deviations;
+  deviations.reserve(remainder.size());
+  for (auto value : remainder) {
+    if (!std::isnan(value)) {
+      deviations.push_back(std::abs(value));
+    }
+  }
+
+  std::vector<int64_t> indices;
+  if (deviations.empty()) {
+    return indices;
+  }
+
+  auto mid = deviations.begin() + deviations.size() / 2;
+  std::nth_element(deviations.begin(), mid, deviations.end());
+  auto limit = threshold * 1.4826 * static_cast<double>(*mid);
+
+  for (size_t i = 0; i < remainder.size(); i++) {
+    if (std::abs(remainder[i]) > limit) {
+      indices.push_back(static_cast<int64_t>(i));
+    }
+  }
+  return indices;
+}
+FINE_NIF(result_anomalies, 0);
+
+// Helper functions for calculating strength
+double seasonal_strength(ErlNifEnv* env, std::vector<float> seasonal, fine::Term remainder) {
+  return stl::strength(seasonal, to_vector_float(env, remainder));
+}
+FINE_NIF(seasonal_strength, 0);
+
+double trend_strength(ErlNifEnv* env, std::vector<float> trend, fine::Term remainder) {
+  return stl::strength(trend, to_vector_float(env, remainder));
 }
 FINE_NIF(trend_strength, 0);
 
+fine::Term inv_box_cox(ErlNifEnv* env, fine::Term values_term, double lambda) {
+  if (lambda < 0.0 || lambda > 1.0) {
+    throw std::invalid_argument("lambda must be between 0 and 1");
+  }
+  auto values = to_vector_float<double>(env, values_term);
+  stl::inv_box_cox(values, lambda);
+  return to_list_float(env, values);
+}
+FINE_NIF(inv_box_cox, 0);
+
 FINE_INIT("Elixir.Stl.NIF");
@@ -11,8 +11,30 @@ defmodule Stl.NIF do
     end
   end
 
-  def decompose(_series, _period, _params, _include_weights), do: :erlang.nif_error(:nif_not_loaded)
-  def decompose_multi(_series, _periods, _params), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose(_series, _period, _params, _include_weights, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_multi(_series, _periods, _params, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_binary(_series, _period, _params, _include_weights, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_multi_binary(_series, _periods, _params, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_dirty(_series, _period, _params, _include_weights, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_multi_dirty(_series, _periods, _params, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_binary_dirty(_series, _period, _params, _include_weights, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_multi_binary_dirty(_series, _periods, _params, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_yielding(_series, _period, _params, _include_weights, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_binary_yielding(_series, _period, _params, _include_weights, _type), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_native(_series, _period, _params), do: :erlang.nif_error(:nif_not_loaded)
+  def decompose_native_dirty(_series, _period, _params), do: :erlang.nif_error(:nif_not_loaded)
+  def result_slice(_result, _component, _start, _length), do: :erlang.nif_error(:nif_not_loaded)
+  def result_binary(_result, _component), do: :erlang.nif_error(:nif_not_loaded)
+  def result_strength(_result, _component), do: :erlang.nif_error(:nif_not_loaded)
+  def result_stats(_result, _component), do: :erlang.nif_error(:nif_not_loaded)
+  def result_anomalies(_result, _threshold), do: :erlang.nif_error(:nif_not_loaded)
   def seasonal_strength(_seasonal, _remainder), do: :erlang.nif_error(:nif_not_loaded)
   def trend_strength(_trend, _remainder), do: :erlang.nif_error(:nif_not_loaded)
+  def inv_box_cox(_values, _lambda), do: :erlang.nif_error(:nif_not_loaded)
+  def stream_new(_period, _params, _history), do: :erlang.nif_error(:nif_not_loaded)
+  def stream_push(_stream, _values), do: :erlang.nif_error(:nif_not_loaded)
+  def stream_push_dirty(_stream, _values), do: :erlang.nif_error(:nif_not_loaded)
+  def stream_cost(_stream, _count), do: :erlang.nif_error(:nif_not_loaded)
+  def stream_result(_stream, _include_weights), do: :erlang.nif_error(:nif_not_loaded)
+  def stream_size(_stream), do: :erlang.nif_error(:nif_not_loaded)
 end
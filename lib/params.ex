@@ -12,9 +12,14 @@ defmodule Stl.Params do
     inner_loops: non_neg_integer() | nil,
     outer_loops: non_neg_integer() | nil,
     robust: boolean() | nil,
+    initial_trend: [number()] | nil,
+    initial_weights: [number()] | nil,
+    tolerance: float() | nil,
+    outputs: [:seasonal | :trend | :remainder | :weights | :strengths] | nil,
     iterations: pos_integer() | nil,
     lambda: float() | nil,
-    seasonal_lengths: [pos_integer()] | nil
+    seasonal_lengths: [pos_integer()] | nil,
+    warm_start: {pos_integer(), non_neg_integer()} | nil
   ]
 
   defstruct [
@@ -30,8 +35,13 @@ defmodule Stl.Params do
     :inner_loops,
     :outer_loops,
     :robust,
+    :initial_trend,
+    :initial_weights,
+    :tolerance,
+    :outputs,
     :iterations,
     :lambda,
-    :seasonal_lengths
+    :seasonal_lengths,
+    :warm_start
   ]
 end
@@ -0,0 +1,107 @@
+defmodule Stl.Result do
+  @moduledoc ~S"""
+  Result of `Stl.decompose/3` with `native: true`.
+
+  The components stay in native memory, and strengths, statistics and anomalies are computed there. Components only become lists or binaries when asked for, which saves building lists that are never read.
+
+  ```
+  result = Stl.decompose(series, 7, native: true)
+
+  Stl.seasonal_strength(result)
+  Stl.Result.anomalies(result, 3.0)
+  Stl.Result.slice(result, :trend, -7, 7)
+  ```
+  """
+
+  @enforce_keys [:resource, :size]
+  defstruct [:resource, :size]
+
+  @type t :: %__MODULE__{resource: reference(), size: non_neg_integer()}
+
+  @typedoc "A component of a result."
+  @type component :: :seasonal | :trend | :remainder | :weights
+
+  @doc """
+  Returns the seasonal component as a list.
+  """
+  @spec seasonal(t()) :: [float()]
+  def seasonal(result), do: to_list(result, :seasonal)
+
+  @doc """
+  Returns the trend component as a list.
+  """
+  @spec trend(t()) :: [float()]
+  def trend(result), do: to_list(result, :trend)
+
+  @doc """
+  Returns the remainder as a list, with `nil` for missing values.
+  """
+  @spec remainder(t()) :: [float() | nil]
+  def remainder(result), do: to_list(result, :remainder)
+
+  @doc """
+  Returns the robustness weights as a list.
+  """
+  @spec weights(t()) :: [float()]
+  def weights(result), do: to_list(result, :weights)
+
+  @doc """
+  Returns a component as a list.
+  """
+  @spec to_list(t(), component()) :: [float() | nil]
+  def to_list(%__MODULE__{resource: resource, size: size}, component) do
+    Stl.NIF.result_slice(resource, component, 0, size)
+  end
+
+  @doc """
+  Returns a component as a binary of native-endian 32-bit floats, with NaN for missing values.
+
+  The binary shares the memory of the result rather than copying it, and keeps it alive as long as the binary is referenced.
+  """
+  @spec to_binary(t(), component()) :: binary()
+  def to_binary(%__MODULE__{resource: resource}, component) do
+    Stl.NIF.result_binary(resource, component)
+  end
+
+  @doc """
+  Returns `length` values of a component from `start`, as a list. A negative `start` counts from the end.
+
+  ## Examples
+      # The trend of the last week
+      Stl.Result.slice(result, :trend, -7, 7)
+  """
+  @spec slice(t(), component(), integer(), non_neg_integer()) :: [float() | nil]
+  def slice(%__MODULE__{resource: resource, size: size}, component, start, length) do
+    start = if start < 0, do: max(size + start, 0), else: start
+    Stl.NIF.result_slice(resource, component, start, length)
+  end
+
+  @doc """
+  Calculate the seasonal strength, as `Stl.seasonal_strength/1`.
+  """
+  @spec seasonal_strength(t()) :: float()
+  def seasonal_strength(%__MODULE__{resource: resource}), do: Stl.NIF.result_strength(resource, :seasonal)
+
+  @doc """
+  Calculate the trend strength, as `Stl.trend_strength/1`.
+  """
+  @spec trend_strength(t()) :: float()
+  def trend_strength(%__MODULE__{resource: resource}), do: Stl.NIF.result_strength(resource, :trend)
+
+  @doc """
+  Returns the mean, sample variance, minimum and maximum of a component, leaving out missing values.
+  """
+  @spec stats(t(), component()) :: %{mean: float(), variance: float(), min: float(), max: float()}
+  def stats(%__MODULE__{resource: resource}, component) do
+    {mean, variance, min, max} = Stl.NIF.result_stats(resource, component)
+    %{mean: mean, variance: variance, min: min, max: max}
+  end
+
+  @doc """
+  Returns the indices of the points whose remainder is more than `threshold` robust standard deviations from zero, taking 1.4826 times the median absolute remainder as the standard deviation.
+  """
+  @spec anomalies(t(), number()) :: [non_neg_integer()]
+  def anomalies(%__MODULE__{resource: resource}, threshold \\ 3.0) when is_number(threshold) do
+    Stl.NIF.result_anomalies(resource, threshold / 1)
+  end
+end
@@ -24,9 +24,9 @@ defmodule Stl do
     trend_strength = Stl.trend_strength(result)
 
     IO.puts("Seasonal strength: #{seasonal_strength}")
-    # Seasonal strength: 0.28411169658385693
+    # Seasonal strength: 0.28411168877222825
     IO.puts("Trend strength: #{trend_strength}")
-    # Trend strength: 0.16384239106781462
+    # Trend strength: 0.16384242140029004
     ```
 
     For multi seasonal trends, the second param should be an integer list of periods.
@@ -36,12 +36,34 @@ defmodule Stl do
     ```
   """
 
+  # cost above which decompositions run on a dirty CPU scheduler, about a
+  # millisecond of work
+  @dirty_threshold 10_000
+
   @typedoc "Result of STL decomposition."
   @type t :: %{
-    required(:seasonal) => [float()],
-    required(:trend) => [float()],
-    required(:remainder) => [float()],
-    optional(:weights) => [float()]
+    optional(:seasonal) => [float()],
+    optional(:trend) => [float()],
+    optional(:remainder) => [float() | nil],
+    optional(:weights) => [float()],
+    optional(:seasonal_strength) => float(),
+    optional(:trend_strength) => float(),
+    optional(:inner_loops) => non_neg_integer(),
+    optional(:outer_loops) => non_neg_integer()
+  }
+
+  @typedoc """
+  Result of `decompose_binary/3`, with components packed like the series. For MSTL, `:seasonal` is a list of binaries.
+  """
+  @type binary_result :: %{
+    optional(:seasonal) => binary() | [binary()],
+    optional(:trend) => binary(),
+    optional(:remainder) => binary(),
+    optional(:weights) => binary(),
+    optional(:seasonal_strength) => float(),
+    optional(:trend_strength) => float(),
+    optional(:inner_loops) => non_neg_integer(),
+    optional(:outer_loops) => non_neg_integer()
   }
 
   @typedoc "Result of a robust STL decomposition."
@@ -56,7 +78,7 @@ defmodule Stl do
   Decompose a time series using STL (Seasonal and Trend decomposition using Loess).
 
   ## Parameters
-  * `series` - A list of numbers or a map with keys (e.g., dates) and values.
+  * `series` - A list of numbers or a map with keys (e.g., dates) and values. Missing values are `nil`: they are ignored by the fit, and their remainder is `nil`.
   * `:period` - REQUIRED: The period of the seasonal component (must be >= 2).
   * `opts` - Options for the decomposition:
     * `:seasonal_length` - Length of the seasonal smoother.
@@ -72,10 +94,19 @@ defmodule Stl do
     * `:outer_loops` - Number of iterations of robust fitting.
     * `:robust` - If robustness iterations are to be used (boolean).
     * `:include_weights` - Whether to include robustness weights in the result (boolean).
+    * `:initial_trend` - Trend to start from instead of zero, such as the trend of a previous result for a similar series. Needs fewer `:inner_loops`.
+    * `:initial_weights` - Robustness weights of the first pass, such as the weights of a previous robust result. Needs fewer `:outer_loops`.
+    * `:dirty` - Whether to run on a dirty CPU scheduler: `true`, `false`, or `:auto` (the default) to do so when the estimated cost, `length × periods × (outer_loops + 1) × inner_loops`, is above the `:dirty_threshold` of the `:ex_stl` application environment (10,000 by default, about a millisecond of work).
+    * `:yield` - Whether decompositions that would run on a dirty scheduler instead run on the normal scheduler in slices, yielding between them, so that they share it fairly without a dirty scheduler. Defaults to the `:yield` of the `:ex_stl` application environment, or `false`. MSTL always uses a dirty scheduler.
+    * `:tolerance` - Stops the loops once they converge: an inner loop once it changes trend plus seasonal by at most `tolerance` times the range of the series, or by rounding error when that is larger, as for a constant series, and robustness iterations once new weights change by at most `tolerance`. The result then has `:inner_loops` and `:outer_loops` with the loops run.
+    * `:outputs` - The parts of the result to compute, from `:seasonal`, `:trend`, `:remainder`, `:weights` and `:strengths`, which adds `:seasonal_strength` and `:trend_strength`. Defaults to the components, with `:weights` when `:include_weights` or `:robust` is set. Only for a single period.
+    * `:type` - `:f32` (the default) or `:f64`, the precision to decompose in. With `:f64`, values such as large integer counters are not rounded to 32-bit floats.
+    * `:native` - Returns a `Stl.Result` that keeps the components in native memory instead of a map of lists (boolean). Only for a single period, and always in 32-bit floats.
+    * `:lambda` - Lambda for Box-Cox transformation (between 0 and 1). The transformed series is decomposed, and `inv_box_cox/2` brings components back to the scale of the series.
     * For MSTL (when period is a list):
     * `:iterations` - Number of iterations for MSTL.
-    * `:lambda` - Lambda for Box-Cox transformation (between 0 and 1).
     * `:seasonal_lengths` - Lengths of the seasonal smoothers.
+    * `:warm_start` - `{inner_loops, outer_loops}` for starting each iteration after the first from the trend and weights of the previous one. Without it, every iteration starts from a zero trend, as in the reference MSTL.
 
     ## Examples
 
@@ -107,7 +138,7 @@ defmodule Stl do
           seasonal_lengths: [11, 731]
         )
   """
-  @spec decompose([number()] | map(), pos_integer() | [pos_integer()], Stl.Params.t()) :: t()
+  @spec decompose([number() | nil] | map(), pos_integer() | [pos_integer()], Stl.Params.t()) :: t() | Stl.Result.t()
   def decompose(series, period, opts \\ [])
 
   def decompose(_series, period, _opts) when period < 2 do
@@ -119,29 +150,133 @@ defmodule Stl do
   end
 
   def decompose(series, period, opts) when is_integer(period) do
+    if Keyword.get(opts, :native, false),
+      do: decompose_native(series, period, opts),
+    else: decompose_list(series, period, opts)
+  end
+
+  def decompose(series, periods, opts) when is_list(periods) do
+    if Keyword.get(opts, :native, false) do
+      raise ArgumentError, "native results are not supported for multiple periods"
+    end
+
+    if Keyword.has_key?(opts, :outputs) do
+      raise ArgumentError, "outputs are not supported for multiple periods"
+    end
+
     series_values = extract_series_values(series)
-    include_weights = Keyword.get(opts, :include_weights, false) || Keyword.get(opts, :robust, false)
     params = struct(Stl.Params, opts)
+    type = Keyword.get(opts, :type, :f32)
 
-    {seasonal, trend, remainder, weights} = Stl.NIF.decompose(series_values, period, params, include_weights)
+    {seasonal, trend, remainder, _} =
+      case scheduler(length(series_values), periods, opts) do
+        :normal -> Stl.NIF.decompose_multi(series_values, periods, params, type)
+        :dirty -> Stl.NIF.decompose_multi_dirty(series_values, periods, params, type)
+      end
 
-    result = %{
+    %{
       seasonal: seasonal,
       trend: trend,
       remainder: remainder
     }
+  end
 
-    # Add weights if requested or if robust is true
-    if include_weights && weights != [],
-      do: Map.put(result, :weights, weights),
+  defp decompose_list(series, period, opts) do
+    series_values = extract_series_values(series)
+    outputs = outputs(opts)
+    include_weights = :weights in outputs
+    params = struct(Stl.Params, Keyword.put(opts, :outputs, outputs))
+    type = Keyword.get(opts, :type, :f32)
+
+    {seasonal, trend, remainder, weights, inner_loops, outer_loops, strengths} =
+      case scheduler(length(series_values), period, opts) do
+        :normal -> Stl.NIF.decompose(series_values, period, params, include_weights, type)
+        :dirty -> Stl.NIF.decompose_dirty(series_values, period, params, include_weights, type)
+        :yield -> Stl.NIF.decompose_yielding(series_values, period, params, include_weights, type)
+      end
+
+    result = build_result(%{seasonal: seasonal, trend: trend, remainder: remainder, weights: weights}, outputs, strengths)
+
+    # Report the loops run when they may stop early
+    if Keyword.get(opts, :tolerance),
+      do: Map.merge(result, %{inner_loops: inner_loops, outer_loops: outer_loops}),
     else: result
   end
 
-  def decompose(series, periods, opts) when is_list(periods) do
+  # Native results are kept whole, so they are never computed in slices
+  defp decompose_native(series, period, opts) do
     series_values = extract_series_values(series)
     params = struct(Stl.Params, opts)
 
-    {seasonal, trend, remainder, _} = Stl.NIF.decompose_multi(series_values, periods, params)
+    resource =
+      case scheduler(length(series_values), period, opts) do
+        :normal -> Stl.NIF.decompose_native(series_values, period, params)
+        _ -> Stl.NIF.decompose_native_dirty(series_values, period, params)
+      end
+
+    %Stl.Result{resource: resource, size: length(series_values)}
+  end
+
+  @doc """
+  Decompose a time series packed in a binary of native-endian floats, such as one built with `<<value::float-32-native>>` or taken from an Nx tensor.
+
+  The binary is read in place rather than converted to a list, and each component is returned as a binary of the same type, which avoids the cost of building lists for long series. Missing values are NaN, and their remainder is NaN.
+
+  ## Parameters
+  * `series` - A binary of 32-bit or 64-bit floats.
+  * `period` - The period of the seasonal component, or a list of periods for MSTL.
+  * `opts` - The options of `decompose/3`, and:
+    * `:type` - `:f32` (the default) or `:f64`, the type of the floats in the series and the result.
+
+  ## Examples
+      series = for value <- values, into: <<>>, do: <<value::float-32-native>>
+      %{trend: trend} = Stl.decompose_binary(series, 7)
+      for <<value::float-32-native <- trend>>, do: value
+  """
+  @spec decompose_binary(binary(), pos_integer() | [pos_integer()], Stl.Params.t()) :: binary_result()
+  def decompose_binary(series, period, opts \\ [])
+
+  def decompose_binary(_series, period, _opts) when is_integer(period) and period < 2 do
+    raise ArgumentError, "period must be greater than 1"
+  end
+
+  def decompose_binary(_series, [], _opts) do
+    raise ArgumentError, "periods must not be empty"
+  end
+
+  def decompose_binary(series, period, opts) when is_binary(series) and is_integer(period) do
+    outputs = outputs(opts)
+    include_weights = :weights in outputs
+    params = struct(Stl.Params, Keyword.put(opts, :outputs, outputs))
+    type = Keyword.get(opts, :type, :f32)
+
+    {seasonal, trend, remainder, weights, inner_loops, outer_loops, strengths} =
+      case scheduler(binary_size(series, type), period, opts) do
+        :normal -> Stl.NIF.decompose_binary(series, period, params, include_weights, type)
+        :dirty -> Stl.NIF.decompose_binary_dirty(series, period, params, include_weights, type)
+        :yield -> Stl.NIF.decompose_binary_yielding(series, period, params, include_weights, type)
+      end
+
+    result = build_result(%{seasonal: seasonal, trend: trend, remainder: remainder, weights: weights}, outputs, strengths)
+
+    if Keyword.get(opts, :tolerance),
+      do: Map.merge(result, %{inner_loops: inner_loops, outer_loops: outer_loops}),
+    else: result
+  end
+
+  def decompose_binary(series, periods, opts) when is_binary(series) and is_list(periods) do
+    if Keyword.has_key?(opts, :outputs) do
+      raise ArgumentError, "outputs are not supported for multiple periods"
+    end
+
+    params = struct(Stl.Params, opts)
+    type = Keyword.get(opts, :type, :f32)
+
+    {seasonal, trend, remainder} =
+      case scheduler(binary_size(series, type), periods, opts) do
+        :normal -> Stl.NIF.decompose_multi_binary(series, periods, params, type)
+        :dirty -> Stl.NIF.decompose_multi_binary_dirty(series, periods, params, type)
+      end
 
     %{
       seasonal: seasonal,
@@ -162,9 +297,11 @@ defmodule Stl do
   ## Examples
       iex> result = Stl.decompose([5.0, 9.0, 2.0, 9.0, 0.0, 6.0, 3.0], 2)
       iex> Stl.seasonal_strength(result)
-      0.9422302715663797
+      0.942230291892625
   """
-  @spec seasonal_strength(t()) :: float()
+  @spec seasonal_strength(t() | Stl.Result.t()) :: float()
+  def seasonal_strength(%Stl.Result{} = result), do: Stl.Result.seasonal_strength(result)
+  def seasonal_strength(%{seasonal_strength: strength}), do: strength
   def seasonal_strength(%{seasonal: s, remainder: r}), do: Stl.NIF.seasonal_strength(s, r)
 
   @doc """
@@ -178,11 +315,26 @@ defmodule Stl do
 
       iex> result = Stl.decompose([5.0, 9.0, 2.0, 9.0, 0.0, 6.0, 3.0], 2)
       iex> Stl.trend_strength(result)
-      0.727898191447705
+      0.7278982581887488
   """
-  @spec trend_strength(t()) :: float()
+  @spec trend_strength(t() | Stl.Result.t()) :: float()
+  def trend_strength(%Stl.Result{} = result), do: Stl.Result.trend_strength(result)
+  def trend_strength(%{trend_strength: strength}), do: strength
   def trend_strength(%{trend: t, remainder: r}), do: Stl.NIF.trend_strength(t, r)
 
+  @doc """
+  Inverts the Box-Cox transformation with `lambda`, such as to bring the trend of a decomposition with `:lambda`, or its trend plus seasonal component, back to the scale of the series.
+
+  ## Examples
+
+      iex> Stl.inv_box_cox([0.0, 2.0], 0.5)
+      [1.0, 4.0]
+  """
+  @spec inv_box_cox([number()], number()) :: [float()]
+  def inv_box_cox(values, lambda) when is_list(values) and is_number(lambda) do
+    Stl.NIF.inv_box_cox(values, lambda / 1)
+  end
+
   defp extract_series_values(series) when is_list(series), do: series
 
   defp extract_series_values(series) when is_map(series) do
@@ -190,4 +342,67 @@ defmodule Stl do
     |> Enum.sort_by(fn {k, _} -> k end)
     |> Enum.map(fn {_, v} -> v end)
   end
+
+  # Outputs to compute: those asked for, or the components, with weights
+  # if requested or if robust is true
+  defp outputs(opts) do
+    Keyword.get_lazy(opts, :outputs, fn ->
+      if Keyword.get(opts, :include_weights, false) || Keyword.get(opts, :robust, false),
+        do: [:seasonal, :trend, :remainder, :weights],
+      else: [:seasonal, :trend, :remainder]
+    end)
+  end
+
+  # Result with the components in outputs, and the strengths when computed
+  defp build_result(components, outputs, strengths) do
+    result = Map.take(components, outputs)
+
+    case strengths do
+      {seasonal_strength, trend_strength} -> Map.merge(result, %{seasonal_strength: seasonal_strength, trend_strength: trend_strength})
+      nil -> result
+    end
+  end
+
+  # Estimated cost of a decomposition, in points times loops. MSTL fits
+  # each period once per iteration.
+  defp cost(size, periods, opts) do
+    robust = Keyword.get(opts, :robust, false)
+    inner_loops = Keyword.get(opts, :inner_loops) || if(robust, do: 1, else: 2)
+    outer_loops = Keyword.get(opts, :outer_loops) || if(robust, do: 15, else: 0)
+
+    fits =
+      case periods do
+        [_] -> 1
+        periods when is_list(periods) -> length(periods) * (Keyword.get(opts, :iterations) || 2)
+        _ -> 1
+      end
+
+    size * fits * (outer_loops + 1) * inner_loops
+  end
+
+  # Cost above which work runs on a dirty CPU scheduler, shared with
+  # Stl.Stream
+  @doc false
+  def dirty_threshold, do: Application.get_env(:ex_stl, :dirty_threshold, @dirty_threshold)
+
+  # Scheduler to decompose on: the normal one, a dirty CPU one, or the
+  # normal one in slices
+  defp scheduler(size, periods, opts) do
+    dirty =
+      case Keyword.get(opts, :dirty, :auto) do
+        :auto -> cost(size, periods, opts) > dirty_threshold()
+        dirty -> dirty
+      end
+
+    yield = Keyword.get_lazy(opts, :yield, fn -> Application.get_env(:ex_stl, :yield, false) end)
+
+    cond do
+      !dirty -> :normal
+      yield && is_integer(periods) -> :yield
+      true -> :dirty
+    end
+  end
+
+  defp binary_size(series, :f64), do: div(byte_size(series), 8)
+  defp binary_size(series, _type), do: div(byte_size(series), 4)
 end
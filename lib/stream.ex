@@ -0,0 +1,92 @@
+defmodule Stl.Stream do
+  @moduledoc ~S"""
+  Incremental STL decomposition of a growing series.
+
+  A stream keeps the points pushed so far and their components. Each push refits only the tail of the series that the new points can change, which follows from the smoothing lengths and jumps, so the cost of a push does not depend on how many points came before it. Older points keep the components they had when they left the tail.
+
+  Without robustness, the components match those of `Stl.decompose/3` on the same values, except near the start of long series. Like the reference STL, loess fits a window with a constant instead of a line when its points spread less than a thousandth of the length of the series, which happens at the ends of series many times longer than the smoothing windows. Points near the start keep the fits they had when the series was shorter. Robust streams scale their weights by a running median of the residuals of older points, so their components only approximate those of a robust `Stl.decompose/3`: they can differ by a fraction of the size of the remainder around outliers.
+
+  ```
+  stream = Stl.Stream.new(7, robust: true)
+
+  stream
+  |> Stl.Stream.push_many(series)
+  |> Stl.Stream.push(6.0)
+
+  result = Stl.Stream.result(stream)
+  ```
+
+  A stream is a mutable reference: pushes are seen by every process holding it. Calls on a stream that another process is pushing to wait on a dirty CPU scheduler.
+  """
+
+  @opaque t :: reference()
+
+  @doc """
+  Creates a stream for a period.
+
+  ## Parameters
+  * `period` - The period of the seasonal component (must be >= 2).
+  * `opts` - The STL options of `Stl.decompose/3`, and:
+    * `:history` - Minimum number of trailing points to keep, or 0 to keep every point. Defaults to 0.
+  """
+  @spec new(pos_integer(), keyword()) :: t()
+  def new(period, opts \\ [])
+
+  def new(period, _opts) when period < 2 do
+    raise ArgumentError, "period must be greater than 1"
+  end
+
+  def new(period, opts) when is_integer(period) do
+    params = struct(Stl.Params, opts)
+    Stl.NIF.stream_new(period, params, Keyword.get(opts, :history, 0))
+  end
+
+  @doc """
+  Appends a value to a stream, or `nil` for a missing value.
+  """
+  @spec push(t(), number() | nil) :: t()
+  def push(stream, value) when is_number(value) or is_nil(value), do: push_many(stream, [value])
+
+  @doc """
+  Appends a list of values to a stream.
+
+  A push refits up to twice the reach of a new value, which grows with the square of the period and with `inner_loops`. Pushes whose estimated cost, `refit length × (outer_loops + 1) × inner_loops`, is above the `:dirty_threshold` of the `:ex_stl` application environment run on a dirty CPU scheduler, as with `Stl.decompose/3`.
+  """
+  @spec push_many(t(), [number() | nil]) :: t()
+  def push_many(stream, values) when is_list(values) do
+    :ok =
+      if Stl.NIF.stream_cost(stream, length(values)) > Stl.dirty_threshold(),
+        do: Stl.NIF.stream_push_dirty(stream, values),
+        else: Stl.NIF.stream_push(stream, values)
+
+    stream
+  end
+
+  @doc """
+  Returns the components of the points kept by a stream, in the form of `Stl.decompose/3`. The components are empty until the stream has two periods of values.
+
+  ## Options
+  * `:include_weights` - Whether to include robustness weights in the result (boolean).
+  """
+  @spec result(t(), keyword()) :: Stl.t()
+  def result(stream, opts \\ []) do
+    include_weights = Keyword.get(opts, :include_weights, false)
+    {seasonal, trend, remainder, weights} = Stl.NIF.stream_result(stream, include_weights)
+
+    result = %{
+      seasonal: seasonal,
+      trend: trend,
+      remainder: remainder
+    }
+
+    if include_weights,
+      do: Map.put(result, :weights, weights),
+    else: result
+  end
+
+  @doc """
+  Returns the number of points kept by a stream.
+  """
+  @spec size(t()) :: non_neg_integer()
+  def size(stream), do: Stl.NIF.stream_size(stream)
+end
@@ -0,0 +1,134 @@
+// Prints decompositions of test series, or compares the output of a build
+// with SIMD against that of a build with STL_NO_SIMD. Run by make test_simd.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "stl.hpp"
+
+namespace {
+
+// Deterministic noise in [-1, 1].
+double noise(size_t i) {
+    auto x = std::sin(i * 12.9898) * 43758.5453;
+    return 2.0 * (x - std::floor(x)) - 1.0;
+}
+
+template<typename T>
+std::vector<T> series(size_t n, size_t period, double offset) {
+    std::vector<T> y(n);
+    for (size_t i = 0; i < n; i++) {
+        y[i] = (T) (offset + 3.0 * std::sin(i * 2.0 * M_PI / period) + i * 0.01 + noise(i) + (i % 53 == 0 ? 8.0 : 0.0));
+    }
+    return y;
+}
+
+// Prints values with the relative tolerance they are compared with.
+template<typename T>
+void print(const char* name, const std::vector<T>& values, double tolerance) {
+    for (size_t i = 0; i < values.size(); i++) {
+        std::printf("%s %zu %a %a\n", name, i, tolerance, (double) values[i]);
+    }
+}
+
+template<typename T>
+void print(const char* name, const stl::StlResult<T>& result, double tolerance) {
+    std::string prefix(name);
+    print((prefix + ".seasonal").c_str(), result.seasonal, tolerance);
+    print((prefix + ".trend").c_str(), result.trend, tolerance);
+    print((prefix + ".remainder").c_str(), result.remainder, tolerance);
+    print((prefix + ".weights").c_str(), result.weights, tolerance);
+    print((prefix + ".strengths").c_str(), std::vector<double> {result.seasonal_strength(), result.trend_strength()}, tolerance);
+}
+
+void run() {
+    auto y = series<double>(2000, 7, 10.0);
+    auto yf = series<float>(2000, 7, 10.0);
+    auto missing = yf;
+    missing[17] = NAN;
+    missing[1000] = NAN;
+
+    // float series are stored in float, so sums in a different order show
+    // up at the precision of float
+    print("double", stl::params().fit(y, 7), 1e-9);
+    print("double.robust", stl::params().robust(true).fit(y, 7), 1e-9);
+    print("double.long", stl::params().trend_length(1001).fit(y, 7), 1e-9);
+    print("float", stl::params().fit(yf, 7), 1e-5);
+    print("float.robust", stl::params().robust(true).fit(yf, 7), 1e-5);
+    print("float.missing", stl::params().robust(true).fit(missing, 7), 1e-5);
+    print("float.fast", stl::params().robust(true).fit<float, stl::precision::fast_float>(yf, 7), 1e-4);
+    print("float.lambda", stl::params().lambda(0.5).fit(yf, 7), 1e-5);
+
+    std::vector<float> matrix;
+    for (size_t i = 0; i < 500; i++) {
+        for (size_t s = 0; s < 10; s++) {
+            matrix.push_back(yf[i + s * 100]);
+        }
+    }
+    auto batch = stl::params().robust(true).fit_batch(matrix.data(), 10, 500, 7);
+    print("batch.seasonal", batch.seasonal, 1e-5);
+    print("batch.trend", batch.trend, 1e-5);
+
+    auto mstl = stl::mstl_params().lambda(0.5).fit(yf, {7, 30});
+    print("mstl.seasonal", mstl.seasonal[1], 1e-5);
+    print("mstl.trend", mstl.trend, 1e-5);
+
+    auto transformed = stl::box_cox(yf, 0.25);
+    print("box_cox", transformed, 1e-6);
+    stl::inv_box_cox(transformed, 0.25);
+    print("inv_box_cox", transformed, 1e-6);
+}
+
+// Compares two outputs line by line, and returns whether they agree.
+bool compare(const char* expected_path, const char* actual_path) {
+    auto expected = std::fopen(expected_path, "r");
+    auto actual = std::fopen(actual_path, "r");
+    if (expected == nullptr || actual == nullptr) {
+        std::fprintf(stderr, "cannot open %s or %s\n", expected_path, actual_path);
+        return false;
+    }
+
+    char name[64];
+    char actual_name[64];
+    size_t i;
+    size_t actual_i;
+    double tolerance;
+    double e;
+    double a;
+    size_t lines = 0;
+    size_t failures = 0;
+    while (std::fscanf(expected, "%63s %zu %la %la", name, &i, &tolerance, &e) == 4) {
+        if (std::fscanf(actual, "%63s %zu %*a %la", actual_name, &actual_i, &a) != 3 || std::strcmp(name, actual_name) != 0 || i != actual_i) {
+            std::fprintf(stderr, "outputs differ in shape at %s %zu\n", name, i);
+            return false;
+        }
+        lines++;
+        auto agree = std::isnan(e) ? std::isnan(a) : std::abs(a - e) <= tolerance * std::max(1.0, std::abs(e));
+        if (!agree) {
+            if (failures < 10) {
+                std::fprintf(stderr, "%s %zu: expected %.17g, got %.17g\n", name, i, e, a);
+            }
+            failures++;
+        }
+    }
+    if (std::fscanf(actual, "%63s", actual_name) == 1) {
+        std::fprintf(stderr, "outputs differ in length\n");
+        return false;
+    }
+    std::fclose(expected);
+    std::fclose(actual);
+
+    std::printf("%zu values compared, %zu differ\n", lines, failures);
+    return lines > 0 && failures == 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && std::strcmp(argv[1], "compare") == 0) {
+        return compare(argv[2], argv[3]) ? 0 : 1;
+    }
+    run();
+    return 0;
+}
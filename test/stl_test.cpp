@@ -0,0 +1,412 @@
+// Checks of the C++ library that the Elixir tests cannot see, such as
+// reads past the end of buffers. Run by make test_cpp, which builds with
+// the address and undefined behavior sanitizers.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+#include "stl.hpp"
+
+// Allocations made so far, counted to check that fits with a reused
+// workspace do not allocate. Threads of other checks allocate too. The
+// deletes are not inlined, where GCC takes their free for a mismatch.
+std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    if (auto p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+size_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Deterministic noise in [-1, 1].
+double noise(size_t i) {
+    auto x = std::sin(i * 12.9898) * 43758.5453;
+    return 2.0 * (x - std::floor(x)) - 1.0;
+}
+
+template<typename T>
+std::vector<T> series(size_t n, size_t period, double offset) {
+    std::vector<T> y(n);
+    for (size_t i = 0; i < n; i++) {
+        y[i] = (T) (offset + 3.0 * std::sin(i * 2.0 * M_PI / period) + i * 0.01 + noise(i) + (i % 53 == 0 ? 8.0 : 0.0));
+    }
+    return y;
+}
+
+// Moving averages of inputs sized exactly to the data, so that the
+// sanitizer sees any read past the end, including outputs whose length is a
+// multiple of the number of lanes.
+template<typename T>
+void test_moving_average() {
+    for (size_t len : {3, 7, 12}) {
+        for (size_t newn = 4 * 16 * len; newn < 4 * 16 * len + 24; newn++) {
+            auto n = newn + len - 1;
+            auto x = series<T>(n, 7, 0.0);
+            std::vector<T> ave(newn);
+            stl::moving_average(x.data(), n, len, ave.data());
+            for (size_t j = 0; j < newn; j++) {
+                double s = 0.0;
+                for (size_t i = 0; i < len; i++) {
+                    s += x[j + i];
+                }
+                CHECK(std::abs(ave[j] - s / len) <= 1e-4);
+            }
+        }
+    }
+}
+
+// Fits whose moving averages end on a lane boundary.
+void test_fit_lengths() {
+    for (size_t n = 990; n < 1010; n++) {
+        auto y = series<float>(n, 7, 10.0);
+        auto result = stl::params().fit(y, 7);
+        CHECK(result.trend.size() == n);
+    }
+}
+
+// Whether two vectors hold the same bits.
+template<typename T>
+bool same(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+template<typename T>
+bool same(const stl::StlResult<T>& a, const stl::StlResult<T>& b) {
+    return same(a.seasonal, b.seasonal) && same(a.trend, b.trend) && same(a.remainder, b.remainder) && same(a.weights, b.weights);
+}
+
+// Ragged batches give the fits of their series one at a time, for any
+// number of threads.
+void test_fit_ragged() {
+    std::vector<float> values;
+    std::vector<size_t> offsets = {0};
+    std::vector<size_t> periods;
+    std::vector<stl::StlParams> params;
+    for (size_t i = 0; i < 23; i++) {
+        auto period = 4 + i % 9;
+        auto y = series<float>(2 * period + 37 * i * i % 1500, period, i * 1.5);
+        if (i % 5 == 0) {
+            y[y.size() / 2] = NAN;
+        }
+        values.insert(values.end(), y.begin(), y.end());
+        offsets.push_back(values.size());
+        periods.push_back(period);
+        params.push_back(stl::params().robust(i % 3 == 0).trend_jump(1 + i % 4));
+    }
+
+    auto serial = stl::fit_ragged(values, offsets, periods, params, 1);
+    for (size_t threads : {2, 3, 4, 8, 32}) {
+        auto parallel = stl::fit_ragged(values, offsets, periods, params, threads);
+        CHECK(parallel.size() == serial.size());
+        for (size_t i = 0; i < serial.size(); i++) {
+            CHECK(same(serial[i], parallel[i]));
+        }
+    }
+    for (size_t i = 0; i < serial.size(); i++) {
+        auto single = params[i].fit(values.data() + offsets[i], offsets[i + 1] - offsets[i], periods[i]);
+        CHECK(same(serial[i], single));
+    }
+}
+
+// Fits give the same bits with cycle-subseries smoothed on any number of
+// threads.
+void test_threads_subseries() {
+    for (size_t n : {16384, 16385, 20011}) {
+        for (size_t period : {7, 12, 31}) {
+            auto y = series<float>(n, period, 10.0);
+            for (bool robust : {false, true}) {
+                auto params = stl::params().robust(robust).outer_loops(2);
+                auto serial = params.fit(y, period);
+                for (size_t threads : {2, 3, 8}) {
+                    CHECK(same(serial, stl::StlParams(params).threads(threads).fit(y, period)));
+                }
+            }
+        }
+    }
+}
+
+// Fits give the same bits with the points of the trend and low-pass
+// smoothers fit in blocks on any number of threads, whether blocks run
+// est or running moments and whatever the jumps, and with missing values,
+// whose centered windows without gaps are filtered. Double precision keeps
+// the rounding of moments reset at other points from vanishing.
+template<typename T>
+void test_threads_blocks() {
+    std::vector<stl::StlParams> cases = {
+        stl::params().outer_loops(1),
+        stl::params().robust(true).outer_loops(1).trend_length(1001).trend_jump(1),
+        stl::params().robust(true).outer_loops(1).trend_length(301).trend_jump(7).low_pass_length(129).low_pass_jump(3),
+        stl::params().trend_length(201).trend_jump(5).seasonal_jump(2)
+    };
+    for (size_t n : {65536, 70001}) {
+        for (size_t period : {7, 24}) {
+            auto y = series<T>(n, period, 10.0);
+            for (auto& params : cases) {
+                auto serial = params.fit(y, period);
+                for (size_t threads : {2, 5}) {
+                    CHECK(same(serial, stl::StlParams(params).threads(threads).fit(y, period)));
+                }
+            }
+        }
+    }
+
+    auto y = series<T>(70001, 24, 10.0);
+    for (size_t i = 100; i < y.size(); i += 499) {
+        y[i] = NAN;
+    }
+    for (auto& params : cases) {
+        auto serial = params.fit(y, 24);
+        for (size_t threads : {2, 5}) {
+            CHECK(same(serial, stl::StlParams(params).threads(threads).fit(y, 24)));
+        }
+    }
+}
+
+// A fit that reuses a workspace for a series of the same shape allocates
+// nothing, and gives the result of a fit with a fresh workspace.
+template<typename T>
+void test_workspace(const stl::StlParams& params, std::vector<T> y, size_t period) {
+    stl::StlWorkspace<T> workspace;
+    params.fit(y.data(), y.size(), period, workspace);
+    auto data = workspace.result().trend.data();
+
+    // different values of the same shape
+    for (auto& v : y) {
+        v = (T) (v * 1.5 + 2.0);
+    }
+    size_t before = allocations;
+    auto& result = params.fit(y.data(), y.size(), period, workspace);
+    CHECK(allocations == before);
+    CHECK(result.trend.data() == data);
+    CHECK(same(result, params.fit(y, period)));
+
+    // a shorter series fits in the same buffers
+    before = allocations;
+    params.fit(y.data(), y.size() - period - 1, period, workspace);
+    CHECK(allocations == before);
+}
+
+void test_workspaces() {
+    auto y = series<float>(3000, 7, 10.0);
+    auto missing = y;
+    missing[17] = NAN;
+    missing[1000] = NAN;
+
+    test_workspace(stl::params(), y, 7);
+    test_workspace(stl::params().robust(true), y, 7);
+    test_workspace(stl::params().robust(true), missing, 7);
+    test_workspace(stl::params().trend_length(1001).trend_jump(1), y, 7);
+    test_workspace(stl::params().robust(true).trend_length(301).trend_jump(1), y, 7);
+    test_workspace(stl::params().tolerance(1e-3).robust(true), y, 7);
+    test_workspace(stl::params().lambda(0.5), y, 7);
+    test_workspace(stl::params(), series<double>(3000, 24, 10.0), 24);
+}
+
+// A decomposition run in steps gives the bits of one fit at once.
+void test_steps() {
+    auto y = series<float>(3000, 7, 10.0);
+    auto missing = y;
+    missing[17] = NAN;
+    for (auto& params : {stl::params(), stl::params().robust(true), stl::params().tolerance(1e-3).robust(true)}) {
+        for (auto* s : {&y, &missing}) {
+            stl::StlFit<float> fit(params, *s, 7);
+            while (!fit.step()) {
+            }
+            CHECK(same(fit.result(), params.fit(*s, 7)));
+        }
+    }
+}
+
+// A tolerance stops the inner loops of a constant series, whose range is
+// zero, once they only change the fit by rounding error.
+template<typename T>
+void test_constant_tolerance() {
+    for (double c : {0.0, 3.7, -1234.567, 1e6 + 0.1}) {
+        for (size_t period : {7, 24, 365}) {
+            std::vector<T> y(3 * period, (T) c);
+            auto result = stl::params().tolerance(1e-3).inner_loops(10).fit(y, period);
+            CHECK(result.inner_loops < 10);
+            for (size_t i = 0; i < y.size(); i++) {
+                CHECK(std::abs((double) result.seasonal[i] + (double) result.trend[i] - (double) y[i]) <= 16 * std::numeric_limits<T>::epsilon() * std::abs(c));
+            }
+        }
+    }
+}
+
+// Centered windows weighted from a tricube table give the bits of the
+// same windows weighted on the fly, with and without robustness weights.
+template<typename T>
+void test_tricube_table() {
+    stl::tricube_cache<T> cache;
+    for (size_t len : {7, 37, 301}) {
+        auto n = 3 * len;
+        auto half = (len - 1) / 2;
+        auto y = series<T>(n, 7, 10.0);
+        std::vector<T> rw(n);
+        for (size_t i = 0; i < n; i++) {
+            rw[i] = (T) ((double) (i % 10) / 9.0);
+        }
+        auto& table = cache.get((T) half, len);
+        for (int ideg : {0, 1}) {
+            for (bool userw : {false, true}) {
+                for (auto i = half + 1; i + half <= n; i++) {
+                    T direct = 0.0;
+                    T cached = 0.0;
+                    auto ok = stl::est<T, double>(y, n, len, ideg, (T) i, &direct, i - half, i + half, userw, rw);
+                    CHECK(ok == (stl::est<T, double>(y, n, len, ideg, (T) i, &cached, i - half, i + half, userw, rw, &table)));
+                    CHECK(std::memcmp(&direct, &cached, sizeof(T)) == 0);
+                }
+            }
+        }
+    }
+}
+
+// Loess of every njump-th point with est alone, in the windows of ess.
+template<typename T>
+std::vector<T> direct_loess(const std::vector<T>& y, size_t len, int ideg, size_t njump) {
+    auto n = y.size();
+    auto nsh = (len + 1) / 2;
+    std::vector<T> ys(n);
+    std::vector<T> rw;
+    for (size_t i = 1; i <= n; i += njump) {
+        auto nleft = i < nsh ? 1 : (i >= n - nsh + 1 ? n - len + 1 : i - nsh + 1);
+        auto nright = nleft + len - 1;
+        CHECK((stl::est<T, double>(y, n, len, ideg, (T) i, &ys[i - 1], nleft, nright, false, rw)));
+    }
+    return ys;
+}
+
+// The overlap-save FFT filter gives the direct loess to within 1e-11 of
+// the data scale in double precision and to float rounding in single
+// precision, at the lengths and jumps around where it takes over and at
+// the ends of the series.
+template<typename T>
+void test_fft_filter(double tolerance) {
+    for (size_t len : {257, 385, 1001}) {
+        for (size_t njump : {1, 2, 3}) {
+            if (!stl::use_fft_filter(len, njump)) {
+                continue;
+            }
+            for (size_t n : {len + 1, 2 * len + 5, (size_t) 5000}) {
+                for (int ideg : {0, 1}) {
+                    auto y = series<T>(n, 7, 1000.0);
+                    std::vector<T> rw;
+                    std::vector<T> ys(n);
+                    stl::loess_scratch<T> scratch;
+                    stl::ess<T, double>(y, n, len, ideg, njump, false, rw, ys.data(), scratch);
+                    CHECK(scratch.filtered.size() == n);
+                    auto expected = direct_loess(y, len, ideg, njump);
+                    double error = 0.0;
+                    for (size_t i = 1; i <= n; i += njump) {
+                        error = std::max(error, std::abs((double) ys[i - 1] - (double) expected[i - 1]));
+                    }
+                    CHECK(error <= tolerance * 1000.0);
+                }
+            }
+        }
+    }
+}
+
+// Running moments give est to within 1e-8 of the spread of the data, or
+// to the rounding error of est itself far from zero, in double precision,
+// with and without robustness weights, on long series. Every point is fit
+// in order, as ess does, and every 17th is checked.
+void test_loess_moments() {
+    size_t n = 50000;
+    for (double offset : {0.0, 1e6, 1e12}) {
+        auto y = series<double>(n, 7, offset);
+        auto [lo, hi] = std::minmax_element(y.begin(), y.end());
+        auto bound = std::max(1e-8 * (*hi - *lo), 16.0 * std::numeric_limits<double>::epsilon() * std::abs(*hi));
+        std::vector<double> rw(n);
+        for (size_t i = 0; i < n; i++) {
+            rw[i] = i % 31 == 0 ? 0.0 : 0.5 + 0.5 * noise(i + n);
+        }
+        for (size_t len : {65, 301, 2001}) {
+            for (bool userw : {false, true}) {
+                for (int ideg : {0, 1}) {
+                    stl::loess_moments<double> moments(y, n, len, userw, rw);
+                    auto nsh = (len + 1) / 2;
+                    double error = 0.0;
+                    for (size_t i = 1; i <= n; i++) {
+                        auto nleft = i < nsh ? 1 : (i >= n - nsh + 1 ? n - len + 1 : i - nsh + 1);
+                        auto nright = nleft + len - 1;
+                        double fit;
+                        auto ok = moments.fit(i, nleft, nright, ideg, &fit);
+                        if (i % 17 != 1 && i != n) {
+                            continue;
+                        }
+                        double expected;
+                        CHECK(ok == (stl::est<double, double>(y, n, len, ideg, (double) i, &expected, nleft, nright, userw, rw)));
+                        error = std::max(error, std::abs(fit - expected));
+                    }
+                    CHECK(error <= bound);
+                }
+            }
+        }
+    }
+}
+
+}
+
+int main() {
+    test_moving_average<float>();
+    test_moving_average<double>();
+    test_fit_lengths();
+    test_fit_ragged();
+    test_workspaces();
+    test_tricube_table<float>();
+    test_tricube_table<double>();
+    test_steps();
+    test_constant_tolerance<float>();
+    test_constant_tolerance<double>();
+    test_fft_filter<double>(1e-11);
+    test_fft_filter<float>(1e-6);
+    test_loess_moments();
+    test_threads_subseries();
+    test_threads_blocks<float>();
+    test_threads_blocks<double>();
+
+    if (failures > 0) {
+        std::fprintf(stderr, "%zu checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
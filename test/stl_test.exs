@@ -39,6 +39,171 @@ defmodule StlTest do
     assert_elements_in_delta(remainder, Enum.take(result.remainder, 5))
   end
 
+  test "decomposes large integers in double precision" do
+    counters = for value <- @series, do: trunc(value) + 3_000_000_000
+    expected = Stl.decompose(@series, 7, type: :f64)
+    result = Stl.decompose(counters, 7, type: :f64)
+
+    assert_elements_in_delta(expected.seasonal, result.seasonal)
+    assert_elements_in_delta(Enum.map(expected.trend, &(&1 + 3_000_000_000)), result.trend)
+    assert_elements_in_delta(expected.remainder, result.remainder)
+
+    expected = Stl.decompose(@series, [6, 10], type: :f64)
+    result = Stl.decompose(counters, [6, 10], type: :f64)
+
+    assert_elements_in_delta(Enum.at(expected.seasonal, 1), Enum.at(result.seasonal, 1))
+    assert_elements_in_delta(Enum.map(expected.trend, &(&1 + 3_000_000_000)), result.trend)
+  end
+
+  test "smooths long windows of series far from zero" do
+    # a trend window long enough to be smoothed from running moments
+    series = for i <- 0..4999, do: 3 * :math.sin(i * 2 * :math.pi() / 24) + 5 * :math.sin(i * 0.001) + rem(i * 7, 11) / 11
+    offset = 1.0e12
+    opts = [trend_length: 1001, trend_jump: 1, type: :f64]
+    expected = Stl.decompose(series, 24, opts)
+    result = Stl.decompose(Enum.map(series, &(&1 + offset)), 24, opts)
+
+    assert_elements_in_delta(Enum.map(expected.trend, &(&1 + offset)), result.trend, 0.005)
+    assert_elements_in_delta(expected.seasonal, result.seasonal, 0.001)
+  end
+
+  test "handles missing values" do
+    series = @series |> List.replace_at(3, nil) |> List.replace_at(17, nil)
+    result = Stl.decompose(series, 7)
+
+    seasonal = [0.59837091, 0.936351895, -1.15898287, 0.929398179, -0.452014267]
+    trend = [4.18182135, 4.33967781, 4.4975338, 4.69759846, 4.89766264]
+
+    assert_elements_in_delta(seasonal, Enum.take(result.seasonal, 5))
+    assert_elements_in_delta(trend, Enum.take(result.trend, 5))
+    assert Enum.at(result.remainder, 3) == nil
+    assert Enum.at(result.remainder, 17) == nil
+    assert Enum.count(result.remainder, &is_nil/1) == 2
+    assert_in_delta Stl.seasonal_strength(result), 0.247243052324, 0.001
+  end
+
+  test "decomposes a binary" do
+    expected = Stl.decompose(@series, 7, robust: true)
+
+    for {type, size} <- [f32: 32, f64: 64] do
+      series = for value <- @series, into: <<>>, do: <<value::float-native-size(size)>>
+      result = Stl.decompose_binary(series, 7, robust: true, type: type)
+      unpack = fn binary -> for <<value::float-native-size(size) <- binary>>, do: value end
+
+      assert_elements_in_delta(expected.seasonal, unpack.(result.seasonal))
+      assert_elements_in_delta(expected.trend, unpack.(result.trend))
+      assert_elements_in_delta(expected.remainder, unpack.(result.remainder))
+      assert_elements_in_delta(expected.weights, unpack.(result.weights))
+    end
+  end
+
+  test "decomposes a binary with multiple periods" do
+    expected = Stl.decompose(@series, [6, 10])
+    series = for value <- @series, into: <<>>, do: <<value::float-32-native>>
+    result = Stl.decompose_binary(series, [6, 10])
+    unpack = fn binary -> for <<value::float-32-native <- binary>>, do: value end
+
+    assert_elements_in_delta(Enum.at(expected.seasonal, 1), unpack.(Enum.at(result.seasonal, 1)))
+    assert_elements_in_delta(expected.trend, unpack.(result.trend))
+  end
+
+  test "decomposes on a dirty scheduler" do
+    assert Stl.decompose(@series, 7, dirty: true) == Stl.decompose(@series, 7, dirty: false)
+    assert Stl.decompose(@series, [6, 10], dirty: true) == Stl.decompose(@series, [6, 10], dirty: false)
+
+    long_series = Enum.map(1..5000, fn i -> :math.sin(i / 7) + rem(i, 3) end)
+    assert Stl.decompose(long_series, 7, robust: true) == Stl.decompose(long_series, 7, robust: true, dirty: false)
+  end
+
+  test "decomposes in slices on a normal scheduler" do
+    long_series = Enum.map(1..5000, fn i -> :math.sin(i / 7) + rem(i, 3) end)
+    expected = Stl.decompose(long_series, 7, robust: true, dirty: false)
+
+    assert Stl.decompose(long_series, 7, robust: true, yield: true) == expected
+    assert Stl.decompose(@series, 7, dirty: true, yield: true) == Stl.decompose(@series, 7, dirty: false)
+
+    series = for value <- long_series, into: <<>>, do: <<value::float-32-native>>
+    assert Stl.decompose_binary(series, 7, robust: true, yield: true) == Stl.decompose_binary(series, 7, robust: true, dirty: false)
+  end
+
+  test "raises error for binary of partial floats" do
+    assert_raise ArgumentError, "binary size must be a multiple of 4", fn ->
+      Stl.decompose_binary(<<0, 0, 0, 0, 0>>, 7)
+    end
+  end
+
+  test "computes only the requested outputs" do
+    expected = Stl.decompose(@series, 7, robust: true)
+    result = Stl.decompose(@series, 7, robust: true, outputs: [:remainder, :strengths])
+
+    assert Enum.sort(Map.keys(result)) == [:remainder, :seasonal_strength, :trend_strength]
+    assert_elements_in_delta(expected.remainder, result.remainder)
+    assert_in_delta Stl.seasonal_strength(result), Stl.seasonal_strength(expected), 0.0001
+    assert_in_delta Stl.trend_strength(result), Stl.trend_strength(expected), 0.0001
+  end
+
+  test "decomposes with a Box-Cox transformation" do
+    transformed = for value <- @series, do: (:math.sqrt(value) - 1) / 0.5
+    expected = Stl.decompose(transformed, 7)
+    result = Stl.decompose(@series, 7, lambda: 0.5)
+
+    assert_elements_in_delta(expected.seasonal, result.seasonal)
+    assert_elements_in_delta(expected.trend, result.trend)
+
+    fitted = Enum.zip_with([result.seasonal, result.trend, result.remainder], &Enum.sum/1)
+    assert_elements_in_delta(@series, Stl.inv_box_cox(fitted, 0.5))
+  end
+
+  test "decomposes negative values with lambda 1" do
+    series = for value <- @series, do: value - 5.0
+    expected = Stl.decompose(Enum.map(series, &(&1 - 1.0)), 7)
+
+    for type <- [:f32, :f64] do
+      result = Stl.decompose(series, 7, lambda: 1.0, type: type)
+      assert_elements_in_delta(expected.seasonal, result.seasonal)
+      assert_elements_in_delta(expected.trend, result.trend)
+    end
+  end
+
+  test "raises error for values outside the domain of lambda" do
+    assert_raise ArgumentError, "series has values outside the domain of the Box-Cox transformation", fn ->
+      Stl.decompose([-1.0 | tl(@series)], 7, lambda: 0.5)
+    end
+
+    assert_raise ArgumentError, "series has values outside the domain of the Box-Cox transformation", fn ->
+      Stl.decompose(@series, [6, 10], lambda: 0.0)
+    end
+  end
+
+  test "inverts the Box-Cox transformation where lambda z + 1 is negative" do
+    assert Stl.inv_box_cox([-3.0, 0.0], 0.5) == [0.25, 1.0]
+    assert Stl.inv_box_cox([-3.0], 1.0) == [-2.0]
+  end
+
+  test "keeps a native result" do
+    expected = Stl.decompose(@series, 7, robust: true)
+    result = Stl.decompose(@series, 7, robust: true, native: true)
+
+    assert %Stl.Result{size: 30} = result
+    assert_elements_in_delta(expected.seasonal, Stl.Result.seasonal(result))
+    assert_elements_in_delta(expected.trend, Stl.Result.trend(result))
+    assert_elements_in_delta(expected.remainder, Stl.Result.remainder(result))
+    assert_elements_in_delta(expected.weights, Stl.Result.weights(result))
+    assert_elements_in_delta(Enum.take(expected.trend, -7), Stl.Result.slice(result, :trend, -7, 7))
+    assert for(<<value::float-32-native <- Stl.Result.to_binary(result, :trend)>>, do: value) == Stl.Result.trend(result)
+    assert_in_delta Stl.seasonal_strength(result), Stl.seasonal_strength(expected), 0.0001
+    assert_in_delta Stl.trend_strength(result), Stl.trend_strength(expected), 0.0001
+
+    stats = Stl.Result.stats(result, :remainder)
+    assert_in_delta stats.mean, Enum.sum(expected.remainder) / 30, 0.0001
+    assert_in_delta stats.min, Enum.min(expected.remainder), 0.0001
+    assert_in_delta stats.max, Enum.max(expected.remainder), 0.0001
+
+    median = expected.remainder |> Enum.map(&abs/1) |> Enum.sort() |> Enum.at(15)
+    anomalies = for {r, i} <- Enum.with_index(expected.remainder), abs(r) > 2.0 * 1.4826 * median, do: i
+    assert Stl.Result.anomalies(result, 2.0) == anomalies
+  end
+
   test "works with robustness" do
     result = Stl.decompose(@series, 7, robust: true)
 
@@ -87,6 +252,57 @@ defmodule StlTest do
     end
   end
 
+  test "starts from an initial trend" do
+    result = Stl.decompose(@series, 7)
+    warm = Stl.decompose(@series, 7, initial_trend: result.trend, inner_loops: 1)
+
+    assert_elements_in_delta(result.trend, warm.trend, 0.02)
+    assert_elements_in_delta(result.seasonal, warm.seasonal, 0.02)
+  end
+
+  test "starts from initial weights" do
+    result = Stl.decompose(@series, 7, robust: true)
+    warm = Stl.decompose(@series, 7, robust: true, initial_trend: result.trend, initial_weights: result.weights, inner_loops: 1, outer_loops: 1)
+
+    assert_elements_in_delta(result.trend, warm.trend, 0.01)
+    assert_elements_in_delta(result.weights, warm.weights, 0.01)
+  end
+
+  test "raises error for initial trend of wrong length" do
+    assert_raise ArgumentError, "initial_trend must have the same length as series", fn ->
+      Stl.decompose(@series, 7, initial_trend: [1.0, 2.0])
+    end
+  end
+
+  test "stops early with a tolerance" do
+    result = Stl.decompose(@series, 7, inner_loops: 10)
+    converged = Stl.decompose(@series, 7, inner_loops: 10, tolerance: 1.0e-3)
+
+    assert converged.inner_loops < 10
+    assert converged.outer_loops == 0
+    refute Map.has_key?(result, :inner_loops)
+    assert_elements_in_delta(result.trend, converged.trend, 0.001)
+    assert_elements_in_delta(result.seasonal, converged.seasonal, 0.001)
+  end
+
+  test "stops early with a tolerance on a constant series" do
+    for value <- [0.0, 3.7, -1234.567], type <- [:f32, :f64] do
+      result = Stl.decompose(List.duplicate(value, 30), 7, inner_loops: 10, tolerance: 1.0e-3, type: type)
+
+      assert result.inner_loops < 10
+    end
+  end
+
+  test "returns the weights of the last fit when robustness iterations converge" do
+    converged = Stl.decompose(@series, 7, robust: true, tolerance: 1.0e-2)
+    result = Stl.decompose(@series, 7, robust: true, outer_loops: converged.outer_loops - 1)
+
+    assert converged.outer_loops < 15
+    assert_elements_in_delta(result.trend, converged.trend, 1.0e-9)
+    assert_elements_in_delta(result.seasonal, converged.seasonal, 1.0e-9)
+    assert_elements_in_delta(result.weights, converged.weights, 1.0e-9)
+  end
+
   test "calculates seasonal_strength" do
     result = Stl.decompose(@series, 7)
 
@@ -259,6 +475,14 @@ defmodule StlTest do
       assert_elements_in_delta(result1.remainder, result2.remainder, 0.5)
     end
 
+    test "mstl with warm_start parameter" do
+      result = Stl.decompose(@series, [6, 10], iterations: 3)
+      warm = Stl.decompose(@series, [6, 10], iterations: 3, warm_start: {1, 0})
+
+      assert_elements_in_delta(result.trend, warm.trend, 0.1)
+      assert_elements_in_delta(Enum.at(result.seasonal, 0), Enum.at(warm.seasonal, 0), 0.1)
+    end
+
     test "mstl error handling - empty periods list" do
       assert_raise ArgumentError, "periods must not be empty", fn ->
         Stl.decompose(@series, [])
@@ -282,4 +506,102 @@ defmodule StlTest do
     end
   end
 
+  describe "stream" do
+    test "matches decompose when pushed one value at a time" do
+      stream = Enum.reduce(@series, Stl.Stream.new(7), &Stl.Stream.push(&2, &1))
+      result = Stl.Stream.result(stream)
+      expected = Stl.decompose(@series, 7)
+
+      assert Stl.Stream.size(stream) == length(@series)
+      assert_elements_in_delta(expected.seasonal, result.seasonal)
+      assert_elements_in_delta(expected.trend, result.trend)
+      assert_elements_in_delta(expected.remainder, result.remainder)
+    end
+
+    test "works with robustness" do
+      stream =
+        Stl.Stream.new(7, robust: true)
+        |> Stl.Stream.push_many(Enum.take(@series, 20))
+        |> Stl.Stream.push_many(Enum.drop(@series, 20))
+
+      result = Stl.Stream.result(stream, include_weights: true)
+      expected = Stl.decompose(@series, 7, robust: true)
+
+      assert_elements_in_delta(expected.trend, result.trend)
+      assert_elements_in_delta(expected.weights, result.weights)
+    end
+
+    test "refits the tail of series longer than its reach" do
+      # about ten times the reach of a stream with period 7
+      series =
+        for i <- 0..999 do
+          x = :math.sin(i * 12.9898) * 43758.5453
+          noise = 2 * (x - Float.floor(x)) - 1
+          10 + 3 * :math.sin(i * 2 * :math.pi() / 7) + i * 0.01 + noise + if(rem(i, 53) == 0, do: 8, else: 0)
+        end
+
+      stream = series |> Enum.chunk_every(10) |> Enum.reduce(Stl.Stream.new(7), &Stl.Stream.push_many(&2, &1))
+      result = Stl.Stream.result(stream)
+      expected = Stl.decompose(series, 7)
+
+      assert_elements_in_delta(expected.seasonal, result.seasonal, 1.0e-4)
+      assert_elements_in_delta(expected.trend, result.trend, 1.0e-4)
+      assert_elements_in_delta(expected.remainder, result.remainder, 1.0e-4)
+
+      # robust weights come from a running scale of older residuals, so the
+      # components are close to those of a full fit rather than equal. The
+      # first push costs more than the dirty threshold.
+      {head, tail} = Enum.split(series, 700)
+      stream = Stl.Stream.new(7, robust: true) |> Stl.Stream.push_many(head)
+      stream = tail |> Enum.chunk_every(10) |> Enum.reduce(stream, &Stl.Stream.push_many(&2, &1))
+      result = Stl.Stream.result(stream)
+      expected = Stl.decompose(series, 7, robust: true)
+
+      errors = Enum.zip_with(expected.trend, result.trend, &abs(&1 - &2))
+      assert Enum.sum(errors) / length(errors) < 0.02
+      assert Enum.max(errors) < 0.25
+    end
+
+    test "refits the tail of series longer than its reach with a longer period" do
+      # three times the reach of two inner loops with period 24
+      series =
+        for i <- 0..4799 do
+          x = :math.sin(i * 12.9898) * 43758.5453
+          noise = 2 * (x - Float.floor(x)) - 1
+          10 + 3 * :math.sin(i * 2 * :math.pi() / 24) + i * 0.01 + noise + if(rem(i, 53) == 0, do: 8, else: 0)
+        end
+
+      stream = series |> Enum.chunk_every(48) |> Enum.reduce(Stl.Stream.new(24), &Stl.Stream.push_many(&2, &1))
+      result = Stl.Stream.result(stream)
+      expected = Stl.decompose(series, 24)
+
+      assert_elements_in_delta(expected.seasonal, result.seasonal, 1.0e-4)
+      assert_elements_in_delta(expected.trend, result.trend, 1.0e-4)
+      assert_elements_in_delta(expected.remainder, result.remainder, 1.0e-4)
+    end
+
+    test "takes pushes from several processes at once" do
+      stream = Stl.Stream.new(7)
+
+      1..8
+      |> Enum.map(fn _ -> Task.async(fn -> Enum.each(1..50, fn _ -> Stl.Stream.push_many(stream, @series) end) end) end)
+      |> Enum.each(&Task.await(&1, :infinity))
+
+      assert Stl.Stream.size(stream) == 8 * 50 * length(@series)
+      assert length(Stl.Stream.result(stream).trend) == 8 * 50 * length(@series)
+    end
+
+    test "has no components before two periods" do
+      stream = Stl.Stream.new(7) |> Stl.Stream.push_many(Enum.take(@series, 13))
+
+      assert Stl.Stream.size(stream) == 13
+      assert Stl.Stream.result(stream) == %{seasonal: [], trend: [], remainder: []}
+    end
+
+    test "raises error for invalid seasonal_degree" do
+      assert_raise ArgumentError, "seasonal_degree must be 0 or 1", fn ->
+        Stl.Stream.new(7, seasonal_degree: 2)
+      end
+    end
+  end
 end